@@ -0,0 +1,175 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+#include <cstddef>
+#include <vector>
+
+/* scratch memory arena: memory is taken from a contiguous buffer
+   by moving an offset forward (bump allocation) and it is given
+   back by moving the offset back to a previous mark; when the
+   buffer is exhausted the request is served by a separate block
+   and, once the arena is reset, the buffer is reallocated large
+   enough for the whole usage, so that in steady state there is
+   no heap allocation at all; memory is meant to be taken within
+   a Mark/Rewind pair (see ArenaScope) */
+class Arena {
+private:
+  char *buf;
+  std::size_t size; /* size of buf in bytes */
+  std::size_t offset; /* bytes of buf in use */
+  std::size_t spill; /* bytes allocated outside buf */
+  std::vector<char*> blocks; /* blocks allocated outside buf */
+  unsigned int level; /* number of open marks */
+
+  static std::size_t Round(std::size_t bytes)
+  {
+    const std::size_t align = alignof(std::max_align_t);
+
+    return (bytes + align - 1) / align * align;
+  }
+
+public:
+  Arena(std::size_t size_ = 0)
+  {
+    size = Round(size_);
+    offset = 0;
+    spill = 0;
+    level = 0;
+
+    buf = (size != 0) ? new char[size] : NULL;
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  /* array of n elements of type T */
+  template <typename T>
+  T *Alloc(std::size_t n)
+  {
+    std::size_t bytes = Round(n*sizeof(T));
+
+    if (offset + bytes <= size)
+    {
+      char *p = buf + offset;
+      offset += bytes;
+
+      return (T *) p;
+    }
+
+    char *b = new char[bytes];
+    blocks.push_back(b);
+    spill += bytes;
+
+    return (T *) b;
+  }
+
+  /* current position, to be given back to Rewind;
+     marks are nested */
+  std::size_t Mark()
+  {
+    level++;
+
+    return offset;
+  }
+
+  /* release everything allocated after mark; blocks allocated
+     outside buf are only released by the outermost mark */
+  void Rewind(std::size_t mark)
+  {
+    offset = mark;
+
+    if (--level == 0)
+      Reset();
+  }
+
+  /* release everything and, if the buffer was exhausted,
+     grow it to the whole usage */
+  void Reset()
+  {
+    if (blocks.size() != 0)
+    {
+      for (char *b: blocks)
+        delete [] b;
+      blocks.clear();
+
+      if (buf)
+        delete [] buf;
+
+      size += spill;
+      buf = new char[size];
+      spill = 0;
+    }
+
+    offset = 0;
+  }
+
+  std::size_t get_size()
+  {
+    return size;
+  }
+
+  ~Arena()
+  {
+    for (char *b: blocks)
+      delete [] b;
+
+    if (buf)
+      delete [] buf;
+  }
+};
+
+/* releases at the end of a scope everything taken from an
+   arena during the scope */
+class ArenaScope {
+private:
+  Arena& a;
+  std::size_t mark;
+
+public:
+  ArenaScope(Arena& a_)
+      : a(a_), mark(a_.Mark())
+  {
+  }
+
+  ~ArenaScope()
+  {
+    a.Rewind(mark);
+  }
+};
+
+/* scratch arena of the calling thread */
+inline Arena& scratch()
+{
+  static thread_local Arena a;
+
+  return a;
+}
+#endif
@@ -0,0 +1,169 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <functional>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "mdp.hpp"
+
+/* batch of independent agents sharing one model: the model is built
+   (normalised, AlogA and Au precomputed) once by the MDP given and
+   each agent is a clone of it holding only its expectations of
+   hidden states, histories, true states and random number generator;
+   the agents are run concurrently by a team of threads, each agent
+   by a single thread, and are handed out dynamically so that the
+   agents whose episodes end early leave their threads free. The
+   clones are built by a Cloner, so that they may be of a class
+   derived from MDP overriding episode_end. With macro BATCHED_AGENTS the agents are run
+   in lockstep and the expected free energy of each policy is
+   computed for all of them at once, reading the likelihood once
+   for the whole batch; an agent whose episode_end returns true
+   leaves the batch */
+template <typename Ty, std::size_t M>
+class Batch {
+public:
+  /* clone of the model given with the true initial state and the
+     seed given */
+  typedef std::function<MDP<Ty,M>*(MDP<Ty,M>&, std::vector<States*>&,
+                                   unsigned int)> Cloner;
+
+protected:
+  std::vector<MDP<Ty,M>*> _agents;
+  std::vector<std::vector<States*>> _S; /* true states of each agent */
+  unsigned int nt; /* number of threads */
+  double steps; /* agent-steps run */
+  double seconds; /* time taken */
+
+public:
+  Batch(MDP<Ty,M>& m, /* model shared */
+        std::vector<States*>& __S, /* true initial state, copied for each agent */
+        unsigned int Na, /* number of agents */
+        unsigned int seed = 0, /* seed of the first agent, seed+k of the k-th */
+        unsigned int nt_ = 1,
+        Cloner clone = [](MDP<Ty,M>& m, std::vector<States*>& S, unsigned int s) {
+          return new MDP<Ty,M>(m, S, s);
+        }) :
+    nt(nt_), steps(0), seconds(0)
+  {
+#ifndef _OPENMP
+    nt = 1;
+#endif
+    if (nt == 0)
+      nt = 1;
+
+    /* the clones are built one at a time: the first one completes
+       the model of m. The true states are held for the time steps
+       of the histories only */
+    for (unsigned int k = 0; k < Na; k++)
+    {
+      std::vector<States*> s;
+      for (unsigned int i = 0; i < __S.size(); i++)
+        s.push_back(new States(*__S[i], m.getTw()));
+      _S.push_back(s);
+
+      _agents.push_back(clone(m, _S[k], seed+k));
+    }
+  }
+
+  /* run active_inference for all the agents */
+  void run()
+  {
+    auto start = std::chrono::steady_clock::now();
+
+#ifdef BATCHED_AGENTS
+    MDP<Ty,M>::active_inference_batch(_agents, nt);
+#else
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(nt)
+#endif
+    for (std::size_t k = 0; k < _agents.size(); k++)
+      _agents[k]->active_inference();
+#endif
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds += elapsed.count();
+    /* the episodes may have ended before the temporal horizon */
+    for (std::size_t k = 0; k < _agents.size(); k++)
+      steps += _agents[k]->getSteps();
+  }
+
+#ifndef FULL
+  /* one online step of all the agents: obs[k] are the outcomes
+     observed by the k-th agent, whose action is returned in u[k] */
+  void step(const std::vector<std::vector<unsigned int>>& obs, std::vector<int>& u)
+  {
+    if (obs.size() != _agents.size())
+    {
+      std::cerr << "step: the outcomes of each agent are needed" << std::endl;
+      exit(-1);
+    }
+
+    u.resize(_agents.size());
+
+    auto start = std::chrono::steady_clock::now();
+
+#ifdef BATCHED_AGENTS
+    MDP<Ty,M>::step_batch(_agents, obs, u, nt);
+#else
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(nt)
+#endif
+    for (std::size_t k = 0; k < _agents.size(); k++)
+      u[k] = _agents[k]->step(obs[k]);
+#endif
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    seconds += elapsed.count();
+    steps += _agents.size();
+  }
+#endif
+
+  MDP<Ty,M> *operator[](std::size_t k) { return _agents[k]; }
+
+  std::size_t size() const { return _agents.size(); }
+
+  /* agent-steps per second of the runs and steps so far */
+  double throughput() const
+  {
+    return (seconds > 0) ? steps/seconds : 0.0;
+  }
+
+  ~Batch() {
+    std::for_each(_agents.begin(), _agents.end(), delete_pointed_to<MDP<Ty,M>>);
+    for (auto& s: _S)
+      std::for_each(s.begin(), s.end(), delete_pointed_to<States>);
+  }
+};
+#endif
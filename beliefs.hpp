@@ -93,6 +93,17 @@ public:
       value[i] = 0.0;
   }
 
+  /* sum of this object and the one given as a parameter
+     multiplied by a factor */
+  void sum(const Beliefs<Ty>& b, Ty e)
+  {
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for(std::size_t i = 0; i < this->T*this->Ns; i++)
+      value[i] += b.value[i]*e;
+  }
+
   void Ones()
   {
     for(std::size_t i = 0; i < this->T*this->Ns; i++)
@@ -1,6 +1,27 @@
 #ifndef COMMON_H
 #define COMMON_H
 #define FLOAT_TYPE double
+/* joint hidden state size above which the likelihood is contracted
+   one state factor at a time instead of through the joint belief */
+#ifndef HDOT_JOINT_LIMIT
+#define HDOT_JOINT_LIMIT 65536
+#endif
+/* largest fraction of non-zero elements of a likelihood stored
+   in sparse format (SPARSE_LIKELIHOOD) */
+#ifndef SPARSE_LIKELIHOOD_DENSITY
+#define SPARSE_LIKELIHOOD_DENSITY 0.25
+#endif
+/* number of time steps held by the histories of an MDP
+   (STREAMING) */
+#ifndef STREAMING_WINDOW
+#define STREAMING_WINDOW 2
+#endif
+#if defined STREAMING && defined FULL
+#error "STREAMING needs policies of length policy_len (FULL not defined)"
+#endif
+#if defined BATCHED_AGENTS && (defined FULL || defined TREE_SEARCH)
+#error "BATCHED_AGENTS needs the same policies for all the agents (FULL and TREE_SEARCH not defined)"
+#endif
 #if not defined BEST_AS_CDFS && not defined BEST_AS_MAX
 #define BEST_AS_CDFS
 #endif
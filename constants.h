@@ -4,4 +4,13 @@
 const FLOAT_TYPE maxError = 0.00001;
 const FLOAT_TYPE log0 = log(exp(-16));
 const FLOAT_TYPE p0 = exp(-16);
+/* Occam windows of the tree search: actions less likely than
+   occam_u times the most likely one and outcomes less likely
+   than occam_o are not expanded */
+const FLOAT_TYPE occam_u = 1./8;
+const FLOAT_TYPE occam_o = 1./16;
+/* expected free energy of the actions pruned by the Occam window,
+   8 nats below the best one, so that their probability is at
+   most exp(-8) times its one */
+const FLOAT_TYPE occam_G = 8;
 #endif
@@ -31,6 +31,8 @@
 #define CONSTRUCT_POLICIES_HPP
 #include <iostream>
 #include <vector>
+#include <limits>
+#include <cstdlib>
 
 void generatePolicies(int t, int n, std::vector<int>& combination,
                       std::vector<std::vector<int>>& _policies)
@@ -62,4 +64,79 @@ std::vector<std::vector<int>> construct_policies(int Nu, int policy_len)
 
   return policies;
 }
+
+/* policy space: the action of the k-th policy at step j is read
+   from an explicit table of policies or, when the policies are all
+   the sequences of policy_len actions, decoded on the fly from k as
+   a mixed-radix number of policy_len digits in base Nu (the first
+   step is the most significant digit), in the same order as the
+   policies built by construct_policies */
+class Policies {
+private:
+  unsigned int Nu; /* number of actions */
+  unsigned int len; /* policy length */
+  std::size_t Np; /* number of policies */
+  std::vector<std::size_t> radix; /* Nu^(len-1-j), j=0,...,len-1 */
+  std::vector<std::vector<int>> V; /* explicit policies */
+
+public:
+  Policies()
+  {
+    Nu = 0;
+    len = 0;
+    Np = 0;
+  }
+
+  /* explicit policies V[j][k] */
+  Policies(std::vector<std::vector<int>> const &V_)
+       : V(V_)
+  {
+    Nu = 0;
+    len = V.size();
+    Np = (len != 0) ? V[0].size() : 0;
+  }
+
+  /* all the sequences of policy_len actions */
+  Policies(unsigned int Nu_, unsigned int policy_len)
+  {
+    Nu = Nu_;
+    len = policy_len;
+    radix.resize(len);
+
+    Np = 1;
+    for (unsigned int j = len; j-- > 0; )
+    {
+      radix[j] = Np;
+
+      if (Nu != 0 && Np > std::numeric_limits<std::size_t>::max()/Nu)
+      {
+        std::cerr << "Policies: " << Nu << "^" << len << " policies overflow the policy index" << std::endl;
+        exit(-1);
+      }
+
+      Np *= Nu;
+    }
+  }
+
+  /* action of the k-th policy at step j */
+  int operator()(unsigned int j, std::size_t k) const
+  {
+    if (V.size() != 0)
+      return V[j][k];
+
+    return (k / radix[j]) % Nu;
+  }
+
+  /* number of policies */
+  std::size_t get_np() const
+  {
+    return Np;
+  }
+
+  /* policy length */
+  unsigned int get_length() const
+  {
+    return len;
+  }
+};
 #endif
@@ -208,11 +208,9 @@ void _likelihood<T,N>::Observe(std::vector<int> num_states)
   this->Zeros();
 
   /* make the location observation only depend on the location
-     state  */
+     state: the other state factors have dimensions of size 1 */
   for (int s = 0; s < num_states[0]; s++)
-    for (int j = 0; j < num_states[1]; ++j)
-      for (int k = 0; k < num_states[2]; ++k)
-        this->setValue(1,s,s,j,k);
+    this->setValue(1,s,s,0,0);
 }
 
 /* cue1 observation */
@@ -333,49 +331,170 @@ public:
        grid(grid_) {
     };
 
+  /* agent sharing the model of m */
+  _MDP(_MDP<Ty,M>& m, std::vector<States*>& __S, unsigned int seed_ = 0)
+       : MDP<Ty,M>(m, __S, seed_), grid(m.grid) {
+    };
+
   Grid<int> grid;
 
-  void active_inference() override
+  /* the episode ends on the reward positions */
+  bool episode_end(int a, int t) override
   {
-    unsigned int tt = 0;
-
-    while (tt < this->T)
-    {
 #ifdef PRINT
-      std::cout << "active_inference: tt=" << tt << std::endl;
+    PrintAction(a);
+#else
+    (void) a;
 #endif
-
-      this->infer_states(tt);
-
-      /* value of policies (G) */
-      std::vector<Ty> G = this->infer_policies(tt);
-
-      /* next action (the action that minimises expected free energy) */
-      int a = this->sample_action(tt);
+    if (t < 0)
+      return true;
 #ifdef PRINT
-      PrintAction(a);
+    PrintState(this->_S[0]->Get(t), grid);
+    std::cout << "Reward: " << RewardString[this->_O[3]->Get(t)] << std::endl;
 #endif
+    return grid(grid.GetCoord(this->_S[0]->Get(t))) == 100 ||
+           grid(grid.GetCoord(this->_S[0]->Get(t))) == -100;
+  }
+};
 
-      /* sampling of next state (outcome) */
-      if (tt < this->T-1)
-      {
-        /* next sampled state */
-        this->sample_state(tt+1, a);
-
-        /* next observed state */
-        this->sample_observation(tt+1, a);
-
-#ifdef PRINT
-        PrintState(this->_S[0]->Get(tt+1), grid);
-        std::cout << "Reward: " << RewardString[this->_O[3]->Get(tt+1)] << std::endl;
-#endif
-        if (grid(grid.GetCoord(this->_S[0]->Get(tt+1))) == 100 ||
-	    grid(grid.GetCoord(this->_S[0]->Get(tt+1))) == -100)
-          break;
-      }
+/* grid world of 7x5 locations: cue1, cue2 (L1-L4), start and
+   reward positions; the reward is at reward_pos_[reward] and the
+   shock at the other one */
+inline void Init_7_5(Grid<int>& grid_, Coord& cue1_pos_,
+              std::vector<Coord>& cue2_pos_, Coord& start_pos_,
+	      std::vector<Coord>& reward_pos_, unsigned int reward)
+{
+  cue1_pos_ = Coord(0, 2);
+  cue2_pos_ = { Coord(2, 4), Coord(3, 3), Coord(3, 1), Coord(2, 0) };
+  start_pos_ = Coord(0, 4);
+  reward_pos_ = { Coord(5, 3), Coord(5, 1) };
+  grid_.SetAllValues(-1);
+  grid_(cue1_pos_) = 1;
+  for (unsigned int i = 0; i < cue2_pos_.size(); ++i) {
+    grid_(cue2_pos_[i]) = 2+i;
+  }
+  grid_(reward_pos_[reward]) = 100;
+  grid_(reward_pos_[1-reward]) = -100;
+}
 
-      tt += 1;
-    }
+/* generative model of the epistemic chaining task on the 7x5 grid
+   world grid_ (initialised by Init_7_5): prior beliefs about the
+   initial state, true initial state (of T time steps, with cue2
+   and reward), transitions, likelihood and preferences; return the
+   number of states of each factor */
+template <typename Ty>
+std::vector<int> build_epistemic_chaining(Grid<int>& grid_, unsigned int T,
+                                          unsigned int cue2, unsigned int reward,
+                                          std::vector<Beliefs<Ty>*>& __D,
+                                          std::vector<States*>& __S,
+                                          std::vector<std::vector<Transitions<Ty>*>>& __B,
+                                          std::vector<std::vector<likelihood<Ty,4>*>>& __A,
+                                          std::vector<Priors<Ty>*>& __C)
+{
+  Coord cue1_pos_;
+  std::vector<Coord> cue2_pos_;
+  Coord start_position_;
+  std::vector<Coord> reward_pos_;
+
+  Init_7_5(grid_, cue1_pos_, cue2_pos_, start_position_, reward_pos_, reward);
+
+  unsigned int Nu = 4;
+  std::vector<int> Ns = NumStates(7, 5, cue2_pos_.size());
+
+  /* prior beliefs about initial state */
+  _Beliefs<Ty> *_d1 = new _Beliefs<Ty>(Ns[0]);
+  _d1->epistemic_chaining_init(start_position_, grid_);
+  __D.push_back((Beliefs<Ty> *) _d1);
+
+  _Beliefs<Ty> *_d2 = new _Beliefs<Ty>(Ns[1]);
+  _d2->Ones();
+  __D.push_back((Beliefs<Ty> *) _d2);
+
+  _Beliefs<Ty> *_d3 = new _Beliefs<Ty>(Ns[2]);
+  _d3->Ones();
+  __D.push_back((Beliefs<Ty> *) _d3);
+
+  /* true initial state */
+  States *_s1 = new States(T);
+  _s1->Zeros();
+  _s1->Set(grid_.CoordToIndex(start_position_));
+  __S.push_back(_s1);
+
+  States *_s2 = new States(T);
+  _s2->Zeros();
+  _s2->Set(cue2);
+  __S.push_back(_s2);
+
+  States *_s3 = new States(T);
+  _s3->Zeros();
+  _s3->Set(reward);
+  __S.push_back(_s3);
+
+  /* transition */
+  std::vector<Transitions<Ty>*> _b1;
+  for (unsigned int a = 0; a < Nu; a++) {
+    _Transitions<Ty> *__b1 = new _Transitions<Ty>(Ns[0], Ns[0]);
+    __b1->epistemic_chaining_init(a, grid_);
+    _b1.push_back((Transitions<Ty> *) __b1);
   }
-};
+  __B.push_back(_b1);
+
+  std::vector<Transitions<Ty>*> _b2;
+  Transitions<Ty> *__b2 = new Transitions<Ty>(Ns[1], Ns[1]);
+  __b2->Eye();
+  _b2.push_back(__b2);
+  __B.push_back(_b2);
+
+  std::vector<Transitions<Ty>*> _b3;
+  Transitions<Ty> *__b3 = new Transitions<Ty>(Ns[2], Ns[2]);
+  __b3->Eye();
+  _b3.push_back(__b3);
+  __B.push_back(_b3);
+
+  /* likelihood */
+  std::vector<likelihood<Ty,4>*> _a1;
+  _likelihood<Ty,4> *__a1 = new _likelihood<Ty,4>(Ns[0],Ns[0],1,1);
+  __a1->Observe(Ns);
+  _a1.push_back((likelihood<Ty,4> *) __a1);
+  __A.push_back(_a1);
+
+  std::vector<likelihood<Ty,4>*> _a2;
+  _likelihood<Ty,4> *__a2 = new _likelihood<Ty,4>(5,Ns[0],Ns[1],Ns[2]);
+  __a2->Observe(Ns, grid_, cue1_pos_, cue2_pos_);
+  _a2.push_back((likelihood<Ty,4> *) __a2);
+  __A.push_back(_a2);
+
+  std::vector<likelihood<Ty,4>*> _a3;
+  _likelihood<Ty,4> *__a3 = new _likelihood<Ty,4>(3,Ns[0],Ns[1],Ns[2]);
+  __a3->Observe(Ns, grid_, cue2_pos_);
+  _a3.push_back((likelihood<Ty,4> *) __a3);
+  __A.push_back(_a3);
+
+  std::vector<likelihood<Ty,4>*> _a4;
+  _likelihood<Ty,4> *__a4 = new _likelihood<Ty,4>(3,Ns[0],Ns[1],Ns[2]);
+  __a4->Observe(Ns, grid_, reward_pos_, 1);
+  _a4.push_back((likelihood<Ty,4> *) __a4);
+  __A.push_back(_a4);
+
+  /* priors */
+  std::vector<Ty> C1(Ns[0], 0);
+  softmax<Ty>(C1);
+  __C.push_back(new Priors<Ty>(C1));
+
+  std::vector<Ty> C2(5, 0);
+  softmax<Ty>(C2);
+  __C.push_back(new Priors<Ty>(C2));
+
+  std::vector<Ty> C3(3, 0);
+  softmax<Ty>(C3);
+  __C.push_back(new Priors<Ty>(C3));
+
+  std::vector<Ty> C4(3, 0);
+  C4[1] = 2.0; /* make the agent want to encounter the "Cheese" observation level */
+  C4[2] = -4.0; /* make the agent not want to encounter the "Shock" observation level */
+  softmax<Ty>(C4);
+  __C.push_back(new Priors<Ty>(C4));
+
+  return Ns;
+}
 #endif
@@ -51,12 +51,12 @@ int main()
 
   std::vector<std::vector<likelihood<double,3>*>> A;
 
-  likelihood<double,3> a0(4,4,2);
+  /* the location observation does not depend on the context */
+  likelihood<double,3> a0(4,4,1);
   likelihood<double,3> a1(4,4,2);
 
   a0.Zeros();
   a0(0,0,0)=1; a0(1,1,0)=1; a0(2,2,0)=1; a0(3,3,0)=1;
-  a0(0,0,1)=1; a0(1,1,1)=1; a0(2,2,1)=1; a0(3,3,1)=1;
 
   const double a = .9;
   const double b = 1.-a;
@@ -159,7 +159,7 @@ int main()
 
   mdp.active_inference();
 
-  for (int i = 0; i < T; i++)
+  for (unsigned int i = 0; i < mdp.getTw(); i++)
     std::cout << "T=" << i+1
               << " Location: [" << LocationString[mdp._st[i][0]] << "] "
               << "Observation: [" << RewardString[mdp._ot[i][1]] << "]"
@@ -0,0 +1,179 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <stdlib.h>
+#include <ctime>
+#include <iomanip>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "common.h"
+#include "mdp.hpp"
+#include "batch.hpp"
+#include "epistemic_chaining.hpp"
+
+/* throughput of a batch of agents of the epistemic chaining task
+   sharing one model: the model is built once and Na agents, each
+   with its own seed, run their episodes concurrently; the number
+   of agent-steps per second is reported */
+
+/* run Na agents of the model with precision Ty with nt threads and
+   return the agent-steps per second */
+template <typename Ty>
+double throughput(unsigned int T, unsigned int cue2, unsigned int reward,
+                  unsigned int N, unsigned int policyDepth, int seed,
+                  unsigned int Na, unsigned int nt)
+{
+  Grid<int> grid_(7, 5);
+
+  std::vector<Beliefs<Ty>*> __D;
+  std::vector<States*> __S;
+  std::vector<std::vector<Transitions<Ty>*>> __B;
+  std::vector<std::vector<likelihood<Ty,4>*>> __A;
+  std::vector<Priors<Ty>*> __C;
+
+  build_epistemic_chaining<Ty>(grid_, T, cue2, reward, __D, __S, __B, __A, __C);
+
+  unsigned int Nf = __D.size();
+  unsigned int Ng = __A.size();
+
+  std::vector<std::vector<int>> V;
+
+#ifdef FULL
+  /* the policies span the whole temporal horizon */
+  (void) policyDepth;
+  _MDP<Ty,4> *mdp = new _MDP<Ty,4>(__D,__S,__B,__A,__C,V,grid_,T,64,4,1./4,1,N,seed);
+#else
+  _MDP<Ty,4> *mdp = new _MDP<Ty,4>(__D,__S,__B,__A,__C,V,grid_,T,64,4,1./4,1,N,policyDepth,seed);
+#endif
+
+  /* the agents are clones of _MDP, whose episodes end on the reward
+     positions */
+  Batch<Ty,4> *batch = new Batch<Ty,4>(*mdp, __S, Na, seed, nt,
+    [](MDP<Ty,4>& m, std::vector<States*>& S, unsigned int s) {
+      return (MDP<Ty,4> *) new _MDP<Ty,4>((_MDP<Ty,4>&) m, S, s);
+    });
+
+  batch->run();
+
+  double steps = batch->throughput();
+
+  delete batch;
+  delete mdp;
+
+  for (unsigned int f = 0; f < Nf; f++)
+    delete __D[f];
+  for (unsigned int f = 0; f < Nf; f++)
+    delete __S[f];
+  for (unsigned int f = 0; f < Nf; f++)
+    for (unsigned int a = 0; a < __B[f].size(); a++)
+      delete __B[f][a];
+  for (unsigned int g = 0; g < Ng; g++)
+    for (unsigned int a = 0; a < __A[g].size(); a++)
+      delete __A[g][a];
+  for (unsigned int g = 0; g < Ng; g++)
+    delete __C[g];
+
+  return steps;
+}
+
+int main(int argc,char *argv[])
+{
+  if ( (argc > 1) && ((std::string(argv[1]) == "-h") || (std::string(argv[1]) == "--help")) )
+  {
+    std::cerr << "Usage: " << argv[0] << " <seed> <temporal horizon> <policy depth> <agents> <threads> <cue2> <reward>" << std::endl
+              << "temporal horizon: number of total timesteps; "
+              << "policy depth: length of the policies; "
+              << "agents: number of agents of the batch; "
+              << "threads: number of threads running the agents; "
+              << "cue2: <0> cue2 at L1, <1> cue2 at L2, <2> cue2 at L3, <3> cue2 at L4; "
+              << "reward: <0> reward on first location, <1> reward on secondo location"
+	      << std::endl;
+
+    return 0;
+  }
+
+  int seed = 0;
+  if (argc > 1)
+    seed = atoi(argv[1]);
+  std::cout << "seed=" << seed << std::endl;
+
+  unsigned int T = 10;
+  if (argc > 2)
+    T = atoi(argv[2]);
+  std::cout << "T=" << T << std::endl;
+
+  unsigned int policyDepth = 2;
+  if (argc > 3)
+    policyDepth = atoi(argv[3]);
+  std::cout << "policyDepth=" << policyDepth << std::endl;
+
+  unsigned int Na = 64;
+  if (argc > 4)
+    Na = atoi(argv[4]);
+  std::cout << "agents=" << Na << std::endl;
+
+  unsigned int nt = 1;
+#ifdef _OPENMP
+  nt = omp_get_max_threads();
+#endif
+  if (argc > 5)
+    nt = atoi(argv[5]);
+  std::cout << "threads=" << nt << std::endl;
+
+  unsigned int cue2 = 0;
+  if (argc > 6)
+    cue2 = atoi(argv[6]);
+  std::cout << "cue2=" << cue2 << std::endl;
+
+  unsigned int reward = 0;
+  if (argc > 7)
+    reward = atoi(argv[7]);
+  std::cout << "reward=" << reward << std::endl;
+
+  if (Na == 0 || nt == 0) {
+    std::cerr << "the number of agents and of threads must be positive" << std::endl;
+    exit(-1);
+  }
+
+  std::cout << "SIMD kernels: " << simd::get().isa << std::endl;
+
+  unsigned int N = 4;
+
+  double steps = throughput<FLOAT_TYPE>(T, cue2, reward, N, policyDepth,
+                                        seed, Na, nt);
+
+  std::cout << std::fixed << std::setprecision(1)
+            << "Agent-steps per second: " << steps << std::endl;
+
+  std::cout << "=========" << std::endl;
+}
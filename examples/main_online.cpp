@@ -0,0 +1,226 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <stdlib.h>
+#include <iomanip>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "common.h"
+#include "mdp.hpp"
+#include "batch.hpp"
+#include "epistemic_chaining.hpp"
+
+/* agents of the epistemic chaining task driven by an external
+   environment: the environment, not the agents, holds the true
+   states (position, cue2 and reward locations of each agent). At
+   each step it gives every agent the outcomes of its position and
+   moves it by the action returned by Batch::step (MDP::step of each
+   agent), until the agent reaches one of the reward positions */
+
+#ifdef FULL
+#error "the online steps are not available with macro FULL"
+#endif
+
+/* outcomes of the environment in the true state (pos, cue2, reward):
+   the likelihoods of the task are deterministic, so the outcome of
+   each modality is the most likely one */
+template <typename Ty>
+std::vector<unsigned int> Observe(std::vector<std::vector<likelihood<Ty,4>*>>& A,
+                                  unsigned int pos, unsigned int cue2,
+                                  unsigned int reward)
+{
+  std::vector<std::size_t> s = { pos, cue2, reward };
+  std::vector<unsigned int> o;
+
+  for (unsigned int g = 0; g < A.size(); g++)
+    o.push_back(A[g][0]->MaxIndex(s));
+
+  return o;
+}
+
+/* run Na agents of the model with precision Ty, for at most Ts
+   steps each, with nt threads; the k-th agent has cue2 at location
+   k%4 and the reward on location (k/4)%2 */
+template <typename Ty>
+void online(unsigned int T, unsigned int Ts, unsigned int N,
+            unsigned int policyDepth, int seed, unsigned int Na,
+            unsigned int nt)
+{
+  Grid<int> grid_(7, 5);
+
+  std::vector<Beliefs<Ty>*> __D;
+  std::vector<States*> __S;
+  std::vector<std::vector<Transitions<Ty>*>> __B;
+  std::vector<std::vector<likelihood<Ty,4>*>> __A;
+  std::vector<Priors<Ty>*> __C;
+
+  /* the true initial state of the model is not used by the online
+     steps */
+  build_epistemic_chaining<Ty>(grid_, T, 0, 0, __D, __S, __B, __A, __C);
+
+  unsigned int Nf = __D.size();
+  unsigned int Ng = __A.size();
+
+  std::vector<std::vector<int>> V;
+
+  MDP<Ty,4> *mdp = new MDP<Ty,4>(__D,__S,__B,__A,__C,V,T,64,4,1./4,1,N,policyDepth,seed);
+
+  Batch<Ty,4> *batch = new Batch<Ty,4>(*mdp, __S, Na, seed, nt);
+
+  /* true states of the environment */
+  std::vector<unsigned int> pos(Na, __S[0]->Get(0));
+  std::vector<unsigned int> cue2(Na), reward(Na);
+  for (unsigned int k = 0; k < Na; k++)
+  {
+    cue2[k] = k % 4;
+    reward[k] = (k / 4) % 2;
+  }
+
+  /* steps taken by each agent until a reward position, and the
+     outcome found there */
+  std::vector<unsigned int> steps(Na, 0);
+  std::vector<unsigned int> found(Na, 0);
+
+  std::vector<std::vector<unsigned int>> obs(Na);
+  std::vector<int> u;
+
+  for (unsigned int s = 0; s < Ts; s++)
+  {
+    unsigned int active = 0;
+
+    /* the agents that reached a reward position keep observing it */
+    for (unsigned int k = 0; k < Na; k++)
+    {
+      obs[k] = Observe<Ty>(__A, pos[k], cue2[k], reward[k]);
+
+      if (!found[k])
+      {
+        found[k] = obs[k][3];
+        active += (found[k] == 0);
+      }
+    }
+
+    if (active == 0)
+      break;
+
+    batch->step(obs, u);
+
+    for (unsigned int k = 0; k < Na; k++)
+      if (!found[k])
+      {
+        pos[k] = NextState(pos[k], u[k], grid_);
+        steps[k]++;
+      }
+  }
+
+  for (unsigned int k = 0; k < Na; k++)
+    std::cout << "agent " << k << ": cue2=" << Cue2String[cue2[k]]
+              << " reward=" << reward[k] << " steps=" << steps[k]
+              << " " << RewardString[found[k]] << std::endl;
+
+  std::cout << std::fixed << std::setprecision(1)
+            << "Agent-steps per second: " << batch->throughput() << std::endl;
+
+  delete batch;
+  delete mdp;
+
+  for (unsigned int f = 0; f < Nf; f++)
+    delete __D[f];
+  for (unsigned int f = 0; f < Nf; f++)
+    delete __S[f];
+  for (unsigned int f = 0; f < Nf; f++)
+    for (unsigned int a = 0; a < __B[f].size(); a++)
+      delete __B[f][a];
+  for (unsigned int g = 0; g < Ng; g++)
+    for (unsigned int a = 0; a < __A[g].size(); a++)
+      delete __A[g][a];
+  for (unsigned int g = 0; g < Ng; g++)
+    delete __C[g];
+}
+
+int main(int argc,char *argv[])
+{
+  if ( (argc > 1) && ((std::string(argv[1]) == "-h") || (std::string(argv[1]) == "--help")) )
+  {
+    std::cerr << "Usage: " << argv[0] << " <seed> <steps> <policy depth> <agents> <threads>" << std::endl
+              << "steps: maximum number of steps of each agent; "
+              << "policy depth: length of the policies; "
+              << "agents: number of agents (the k-th one with cue2 at L(k%4+1) and reward on location (k/4)%2); "
+              << "threads: number of threads running the agents"
+	      << std::endl;
+
+    return 0;
+  }
+
+  int seed = 0;
+  if (argc > 1)
+    seed = atoi(argv[1]);
+  std::cout << "seed=" << seed << std::endl;
+
+  unsigned int Ts = 20;
+  if (argc > 2)
+    Ts = atoi(argv[2]);
+  std::cout << "steps=" << Ts << std::endl;
+
+  unsigned int policyDepth = 4;
+  if (argc > 3)
+    policyDepth = atoi(argv[3]);
+  std::cout << "policyDepth=" << policyDepth << std::endl;
+
+  unsigned int Na = 8;
+  if (argc > 4)
+    Na = atoi(argv[4]);
+  std::cout << "agents=" << Na << std::endl;
+
+  unsigned int nt = 1;
+#ifdef _OPENMP
+  nt = omp_get_max_threads();
+#endif
+  if (argc > 5)
+    nt = atoi(argv[5]);
+  std::cout << "threads=" << nt << std::endl;
+
+  if (Na == 0 || nt == 0) {
+    std::cerr << "the number of agents and of threads must be positive" << std::endl;
+    exit(-1);
+  }
+
+  /* the temporal horizon only needs to hold the policies, it does
+     not bound the number of online steps */
+  unsigned int T = (policyDepth < 2) ? 2 : policyDepth;
+  unsigned int N = 4;
+
+  online<FLOAT_TYPE>(T, Ts, N, policyDepth, seed, Na, nt);
+
+  std::cout << "=========" << std::endl;
+}
@@ -0,0 +1,217 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <stdlib.h>
+#include <ctime>
+#include <iomanip>
+#include <chrono>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "common.h"
+#include "mdp.hpp"
+#include "epistemic_chaining.hpp"
+
+/* comparison of the single and double precision models of the
+   epistemic chaining task: the expected free energy of the
+   policies at the first time step is computed with both and
+   the differences and the time taken are reported */
+
+/* build the model with precision Ty, compute the expected free
+   energy of the policies R times and return it; elapsed_time is
+   the mean time taken by a computation */
+template <typename Ty>
+std::vector<Ty> expected_free_energy(unsigned int T, unsigned int cue2,
+                                     unsigned int reward, unsigned int N,
+                                     unsigned int policyDepth, int seed,
+                                     unsigned int R, double& elapsed_time)
+{
+  Grid<int> grid_(7, 5);
+
+  std::vector<Beliefs<Ty>*> __D;
+  std::vector<States*> __S;
+  std::vector<std::vector<Transitions<Ty>*>> __B;
+  std::vector<std::vector<likelihood<Ty,4>*>> __A;
+  std::vector<Priors<Ty>*> __C;
+
+  build_epistemic_chaining<Ty>(grid_, T, cue2, reward, __D, __S, __B, __A, __C);
+
+  unsigned int Nf = __D.size();
+  unsigned int Ng = __A.size();
+
+  std::vector<std::vector<int>> V;
+
+#ifdef FULL
+  /* the policies span the whole temporal horizon */
+  (void) policyDepth;
+  _MDP<Ty,4> *mdp = new _MDP<Ty,4>(__D,__S,__B,__A,__C,V,grid_,T,64,4,1./4,1,N,seed);
+#else
+  _MDP<Ty,4> *mdp = new _MDP<Ty,4>(__D,__S,__B,__A,__C,V,grid_,T,64,4,1./4,1,N,policyDepth,seed);
+#endif
+
+  mdp->infer_states(0);
+
+  std::vector<Ty> G;
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (unsigned int r = 0; r < R; r++)
+#ifdef TREE_SEARCH
+    G = mdp->infer_policies_tree(0);
+#else
+    G = mdp->infer_policies(0);
+#endif
+
+  auto end = std::chrono::high_resolution_clock::now();
+
+  std::chrono::duration<double> elapsed = end - start;
+  elapsed_time = elapsed.count()/R;
+
+  delete mdp;
+
+  for (unsigned int f = 0; f < Nf; f++)
+    delete __D[f];
+  for (unsigned int f = 0; f < Nf; f++)
+    delete __S[f];
+  for (unsigned int f = 0; f < Nf; f++)
+    for (unsigned int a = 0; a < __B[f].size(); a++)
+      delete __B[f][a];
+  for (unsigned int g = 0; g < Ng; g++)
+    for (unsigned int a = 0; a < __A[g].size(); a++)
+      delete __A[g][a];
+  for (unsigned int g = 0; g < Ng; g++)
+    delete __C[g];
+
+  return G;
+}
+
+int main(int argc,char *argv[])
+{
+  if ( (argc > 1) && ((std::string(argv[1]) == "-h") || (std::string(argv[1]) == "--help")) )
+  {
+    std::cerr << "Usage: " << argv[0] << " <seed> <temporal horizon> <policy depth> <repetitions> <cue2> <reward>" << std::endl
+              << "temporal horizon: number of total timesteps; "
+              << "policy depth: length of the policies; "
+              << "repetitions: number of computations of the expected free energy timed; "
+              << "cue2: <0> cue2 at L1, <1> cue2 at L2, <2> cue2 at L3, <3> cue2 at L4; "
+              << "reward: <0> reward on first location, <1> reward on secondo location"
+	      << std::endl;
+
+    return 0;
+  }
+
+  int seed = 0;
+  if (argc > 1)
+    seed = atoi(argv[1]);
+  std::cout << "seed=" << seed << std::endl;
+
+  unsigned int T = 10;
+  if (argc > 2)
+    T = atoi(argv[2]);
+  std::cout << "T=" << T << std::endl;
+
+  unsigned int policyDepth = 4;
+  if (argc > 3)
+    policyDepth = atoi(argv[3]);
+  std::cout << "policyDepth=" << policyDepth << std::endl;
+
+  unsigned int R = 10;
+  if (argc > 4)
+    R = atoi(argv[4]);
+  std::cout << "R=" << R << std::endl;
+
+  unsigned int cue2 = 0;
+  if (argc > 5)
+    cue2 = atoi(argv[5]);
+  std::cout << "cue2=" << cue2 << std::endl;
+
+  unsigned int reward = 0;
+  if (argc > 6)
+    reward = atoi(argv[6]);
+  std::cout << "reward=" << reward << std::endl;
+
+  if (R == 0) {
+    std::cerr << "the number of repetitions must be positive" << std::endl;
+    exit(-1);
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel
+  {
+    #pragma omp single
+    printf("Num_threads=%d\n", omp_get_num_threads());
+  }
+#endif
+  std::cout << "SIMD kernels: " << simd::get().isa << std::endl;
+
+  unsigned int N = 4;
+
+  double time_d, time_f;
+
+  std::vector<double> Gd = expected_free_energy<double>(T, cue2, reward, N,
+                                   policyDepth, seed, R, time_d);
+  std::vector<float> Gf = expected_free_energy<float>(T, cue2, reward, N,
+                                   policyDepth, seed, R, time_f);
+
+  if (Gd.size() != Gf.size()) {
+    std::cerr << "different number of policies: " << Gd.size()
+              << " (double) " << Gf.size() << " (float)" << std::endl;
+    exit(-1);
+  }
+
+  /* differences of the expected free energy */
+  double max_abs = 0.0, max_rel = 0.0;
+  for (std::size_t k = 0; k < Gd.size(); k++) {
+    double d = ABS(Gd[k] - (double) Gf[k]);
+
+    if (d > max_abs)
+      max_abs = d;
+    if (Gd[k] != 0.0 && d/ABS(Gd[k]) > max_rel)
+      max_rel = d/ABS(Gd[k]);
+  }
+
+  std::vector<int> best_d = findMaxima(Gd);
+  std::vector<int> best_f = findMaxima(Gf);
+
+  std::cout << "Number of policies: " << Gd.size() << std::endl;
+  std::cout << std::scientific << std::setprecision(3)
+            << "Max absolute difference of G: " << max_abs << std::endl
+            << "Max relative difference of G: " << max_rel << std::endl;
+  std::cout << "Best policy (double): " << best_d[0]
+            << " (float): " << best_f[0] << std::endl;
+  std::cout << std::fixed << std::setprecision(6)
+            << "Time per computation (double): " << time_d << " sec" << std::endl
+            << "Time per computation (float) : " << time_f << " sec" << std::endl
+            << "Speedup: " << std::setprecision(2) << time_d/time_f << std::endl;
+
+  std::cout << "=========" << std::endl;
+}
@@ -0,0 +1,145 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <stdlib.h>
+#include <ctime>
+#include <iomanip>
+#include <chrono>
+#include <fstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "common.h"
+#include "mdp.hpp"
+#include "sweep.hpp"
+#include "epistemic_chaining.hpp"
+
+/* sweep of the epistemic chaining task over the positions of cue2
+   and of the reward: the model of each pair is built once and its
+   episodes, one for each seed, are run concurrently; the result of
+   each episode (steps taken and last reward outcome) is written as
+   a line of comma-separated values */
+
+int main(int argc,char *argv[])
+{
+  if ( (argc > 1) && ((std::string(argv[1]) == "-h") || (std::string(argv[1]) == "--help")) )
+  {
+    std::cerr << "Usage: " << argv[0] << " <seeds> <threads> <temporal horizon> <policy depth> <output>" << std::endl
+              << "seeds: number of episodes of each cue2 and reward, of seeds 0, 1, ...; "
+              << "threads: number of threads running the episodes; "
+              << "temporal horizon: number of total timesteps; "
+              << "policy depth: length of the policies; "
+              << "output: file of the results (standard output if not given)"
+	      << std::endl;
+
+    return 0;
+  }
+
+  unsigned int Nseeds = 16;
+  if (argc > 1)
+    Nseeds = atoi(argv[1]);
+  std::cerr << "seeds=" << Nseeds << std::endl;
+
+  unsigned int nt = std::thread::hardware_concurrency();
+  if (argc > 2)
+    nt = atoi(argv[2]);
+  std::cerr << "threads=" << nt << std::endl;
+
+  unsigned int T = 10;
+  if (argc > 3)
+    T = atoi(argv[3]);
+  std::cerr << "T=" << T << std::endl;
+
+  unsigned int policyDepth = 2;
+  if (argc > 4)
+    policyDepth = atoi(argv[4]);
+  std::cerr << "policyDepth=" << policyDepth << std::endl;
+
+  if (Nseeds == 0 || nt == 0) {
+    std::cerr << "the number of seeds and of threads must be positive" << std::endl;
+    exit(-1);
+  }
+
+  unsigned int N = 4;
+
+  /* grid of the parameters */
+  std::vector<std::string> names = { "cue2", "reward" };
+  std::vector<std::vector<int>> values = { { 0, 1, 2, 3 }, { 0, 1 } };
+
+  auto build = [&](const std::vector<int>& p, Sweep<FLOAT_TYPE,4>::Model& m) {
+    Grid<int> grid_(7, 5);
+
+    build_epistemic_chaining<FLOAT_TYPE>(grid_, T, p[0], p[1], m.D, m.S, m.B, m.A, m.C);
+
+    std::vector<std::vector<int>> V;
+
+#ifdef FULL
+    m.mdp = new _MDP<FLOAT_TYPE,4>(m.D,m.S,m.B,m.A,m.C,V,grid_,T,64,4,1./4,1,N,0);
+#else
+    m.mdp = new _MDP<FLOAT_TYPE,4>(m.D,m.S,m.B,m.A,m.C,V,grid_,T,64,4,1./4,1,N,policyDepth,0);
+#endif
+  };
+
+  Sweep<FLOAT_TYPE,4> sweep(names, values, build, Nseeds, 0, nt);
+
+  /* the episodes end on the reward positions */
+  sweep.clone = [](MDP<FLOAT_TYPE,4>& m, std::vector<States*>& S, unsigned int s) {
+    return (MDP<FLOAT_TYPE,4> *) new _MDP<FLOAT_TYPE,4>((_MDP<FLOAT_TYPE,4>&) m, S, s);
+  };
+
+  /* steps taken in the episode and outcome of the last state
+     reached; with macro STREAMING the histories hold the last time
+     steps only and the last state is at the end of the window */
+  sweep.record = [](MDP<FLOAT_TYPE,4>& m, std::ostream& out) {
+    unsigned int Tw = m.getTw();
+    unsigned int steps = m.getSteps();
+
+    out << steps << "," << m._O[3]->Get(steps < Tw ? steps : Tw-1);
+  };
+  sweep.header = "steps,outcome";
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  if (argc > 5) {
+    std::ofstream out(argv[5]);
+    sweep.run(out);
+  } else
+    sweep.run(std::cout);
+
+  auto end = std::chrono::high_resolution_clock::now();
+
+  std::chrono::duration<double> elapsed = end - start;
+
+  std::cerr << "Episodes: " << sweep.size()*Nseeds << std::endl
+            << std::fixed << std::setprecision(2)
+            << "Episodes per second: " << sweep.size()*Nseeds/elapsed.count() << std::endl;
+}
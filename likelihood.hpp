@@ -45,10 +45,26 @@
 #include "util.hpp"
 #include "constants.h"
 #include "beliefs.hpp"
+#include "arena.hpp"
 #ifdef _OPENMP
 #include "omp.h"
 #endif
 
+/* strided view of n elements of an array, the i-th being
+   data[i*stride]: a fibre of a likelihood along one state
+   factor, read in place */
+template <typename T>
+struct fibre {
+  const T *data;
+  std::size_t n;
+  std::size_t stride;
+
+  const T& operator[](std::size_t i) const
+  {
+    return data[i*stride];
+  }
+};
+
 template <std::size_t...> struct seq {};
 template <std::size_t N, std::size_t... Iseq> struct gen_seq : gen_seq<N-1, N-1, Iseq...> {};
 template <std::size_t... Iseq> struct gen_seq<0, Iseq...> { using type = seq<Iseq...>; };
@@ -83,6 +99,17 @@ namespace detail
       memset(t, 0, mult(s)*sizeof(T));
     }
 
+    likelihood(const likelihood<T,seq<Iseq...>>& l)
+        : s(l.s)
+    {
+      t = NULL;
+      if (l.t)
+      {
+        t = new T[mult(s)];
+        std::copy(l.t, l.t+mult(s), t);
+      }
+    }
+
     ~likelihood()
     {
       if (t)
@@ -270,7 +297,7 @@ namespace detail
           std::size_t ind = k;
 
           for (std::size_t i = 0; i < a.size(); ++i)
-            ind = ind * s[i+1] + a[i];
+            ind = ind * s[i+1] + broadcast(i, a[i]);
 
           if (t[ind] > maxinfo[id].val)
           {
@@ -303,7 +330,7 @@ namespace detail
         std::size_t ind = k;
 
         for (std::size_t i = 0; i < a.size(); ++i)
-          ind = ind * s[i+1] + a[i];
+          ind = ind * s[i+1] + broadcast(i, a[i]);
 
 	if (t[ind] > max)
 	{
@@ -354,6 +381,21 @@ namespace detail
       return a;
     }
 
+    /* return a new object obtained by taking the logarithm
+    of each element of the array */
+    likelihood *Log()
+    {
+      likelihood *a = new likelihood(s);
+
+#ifdef _OPENMP
+      #pragma omp parallel for
+#endif
+      for (std::size_t i = 0; i < mult(s); ++i)
+        a->t[i] = _log(t[i]);
+
+      return a;
+    }
+
     /* multidimensional dot (inner) product
     extract the array elements corresponding
     to the index tuple sq along dimension f */
@@ -379,7 +421,7 @@ namespace detail
           for (std::size_t j = 0; j < sq.size(); ++j)
 	  {
 	    if (j != f)
-	      ind = ind * s[j+1] + sq[j];
+	      ind = ind * s[j+1] + broadcast(j, sq[j]);
 	    else
 	      ind = ind * s[j+1] + i;
 	  }
@@ -392,6 +434,24 @@ namespace detail
       return _Ag;
     }
 
+    /* fibre t(o,sq[0],...,:,...,sq[N-1]) along dimension f of
+    the outcome o, i.e. the row o of Dot(sq, f), as a view of
+    the elements in place */
+    fibre<T> Fibre(std::size_t o, const std::vector<int>& sq, std::size_t f) const
+    {
+      std::size_t ind = o;
+      std::size_t stride = 1;
+
+      for (std::size_t j = 0; j < sq.size(); ++j)
+      {
+        ind = ind * s[j+1] + ((j != f) ? broadcast(j, sq[j]) : 0);
+        if (j > f)
+          stride *= s[j+1];
+      }
+
+      return { &t[ind], s[f+1], stride };
+    }
+
     /* multidimensional dot (inner) product
     inner product obtained by summing the products of
     the likelihood and the vectors xt[i], i=0,...,Nf-1,
@@ -407,7 +467,7 @@ namespace detail
 
       std::size_t offset = mult(s)/s[0];
 
-      T sum_H = 0;
+      typename accumulator<T>::type sum_H = 0;
 
 #ifdef _OPENMP
       #pragma omp parallel for reduction (+:sum_H)
@@ -461,7 +521,7 @@ namespace detail
 
       std::size_t offset = mult(s)/s[0];
 
-      T sum_H = 0;
+      typename accumulator<T>::type sum_H = 0;
 
 #ifdef _OPENMP
       #pragma omp parallel for reduction (+:sum_H)
@@ -533,6 +593,272 @@ namespace detail
       return H;
     }
 
+    /* multidimensional dot (inner) product and epistemic value
+    (see above), serial version taking the result and the
+    temporary outer product from the arena a */
+    T *HDot(T **xt, likelihood& l, T *H, Arena& a)
+    {
+      if (mult(s)/s[0] > HDOT_JOINT_LIMIT)
+        return HDotTTV(xt, &l, H, a);
+
+      T *x = cross(xt, a);
+
+      return HDot(x, l, H, a);
+    }
+
+    /* multidimensional dot (inner) product and epistemic value
+    (see above) of the joint belief x, i.e. of the outer product
+    of the hidden state beliefs already computed by cross; the
+    result is taken from the arena a */
+    T *HDot(T *x, likelihood& l, T *H, Arena& a)
+    {
+      T *_q = a.Alloc<T>(s[0]);
+
+      std::size_t offset = mult(s)/s[0];
+
+      typename accumulator<T>::type sum_H = 0;
+
+      for (std::size_t k = 0; k < s[0]; ++k)
+      {
+        std::size_t _offset = offset * k;
+
+        auto sum_k = T{};
+        _q[k] = opt_dot<T>(offset, &t[_offset], &l.t[_offset], &x[0], &sum_k);
+
+        sum_H += sum_k;
+      }
+
+      *H = sum_H;
+
+      return _q;
+    }
+
+    /* multidimensional dot (inner) product and epistemic value of
+    the whole likelihood (see above), serial version taking the
+    result and the temporary outer product from the arena a */
+    T *HDot(T **xt, T *H, Arena& a)
+    {
+      if (mult(s)/s[0] > HDOT_JOINT_LIMIT)
+        return HDotTTV(xt, NULL, H, a);
+
+      T *x = cross(xt, a);
+
+      return HDot(x, H, a);
+    }
+
+    /* multidimensional dot (inner) product and epistemic value of
+    the whole likelihood (see above) of the joint belief x already
+    computed by cross; the result is taken from the arena a */
+    T *HDot(T *x, T *H, Arena& a)
+    {
+      T *_q = a.Alloc<T>(s[0]);
+
+      std::size_t offset = mult(s)/s[0];
+
+      typename accumulator<T>::type sum_H = 0;
+
+      for (std::size_t k = 0; k < s[0]; ++k)
+      {
+        std::size_t _offset = offset * k;
+
+        auto sum_k = T{};
+#if defined _OPENMP && _OPENMP >= 201307
+        auto const*const __restrict _a = &t[_offset];
+        auto sum = T{};
+        #pragma omp simd reduction (+:sum,sum_k)
+        for(std::size_t j = 0; j < offset; ++j)
+        {
+          T xval = x[j];
+
+          sum += _a[j] * xval;
+
+          sum_k += _a[j] * _log(_a[j]) * xval;
+        }
+
+        _q[k] = sum;
+#else
+        _q[k] = opt_dot<T>(offset, &t[_offset], &x[0], &sum_k);
+#endif
+
+        sum_H += sum_k;
+      }
+
+      *H = sum_H;
+
+      return _q;
+    }
+
+    /* multidimensional dot (inner) product and epistemic value
+    (see above) of n joint beliefs at once: X holds the joint
+    beliefs as the columns of a mult(s)/s[0] by n matrix (row
+    major) and the predicted outcomes are returned as the columns
+    of an s[0] by n matrix (row major), one matrix-matrix product,
+    so that the likelihood is read once for all the beliefs and
+    its zero elements are skipped; l is the likelihood with the
+    products of the elements by their logarithm or NULL to compute
+    them on the fly. The epistemic value of the j-th belief is
+    stored in H[j]; the result is taken from the arena a */
+    T *HDot(T *X, std::size_t n, likelihood *l, T *H, Arena& a)
+    {
+      typedef typename accumulator<T>::type acc_t;
+
+      T *_q = a.Alloc<T>(s[0]*n);
+
+      ArenaScope scope(a);
+
+      std::size_t offset = mult(s)/s[0];
+
+      acc_t *q = a.Alloc<acc_t>(n);
+      acc_t *h = a.Alloc<acc_t>(n);
+      acc_t *sum_H = a.Alloc<acc_t>(n);
+
+      for (std::size_t j = 0; j < n; ++j)
+        sum_H[j] = 0;
+
+      for (std::size_t k = 0; k < s[0]; ++k)
+      {
+        std::size_t _offset = offset * k;
+
+        for (std::size_t j = 0; j < n; ++j)
+          q[j] = h[j] = 0;
+
+        for (std::size_t r = 0; r < offset; ++r)
+        {
+          acc_t ar = t[_offset+r];
+
+          if (ar == 0.0)
+            continue;
+
+          acc_t hr = l ? l->t[_offset+r] : t[_offset+r] * _log(t[_offset+r]);
+
+          auto const*const __restrict x = &X[n*r];
+          acc_t *__restrict _q_ = q;
+          acc_t *__restrict _h_ = h;
+#if defined _OPENMP && _OPENMP >= 201307
+          #pragma omp simd
+#endif
+          for (std::size_t j = 0; j < n; ++j)
+          {
+            _q_[j] += ar * x[j];
+            _h_[j] += hr * x[j];
+          }
+        }
+
+        for (std::size_t j = 0; j < n; ++j)
+        {
+          _q[n*k+j] = q[j];
+          sum_H[j] += h[j];
+        }
+      }
+
+      for (std::size_t j = 0; j < n; ++j)
+        H[j] = sum_H[j];
+
+      return _q;
+    }
+
+    /* multidimensional dot (inner) product and epistemic value
+    (see above) computed without the joint belief: the slice of
+    each outcome is contracted with the vectors xt[i] one state
+    factor at a time, from the last (contiguous) to the first, as
+    a chain of matrix-vector products (tensor-times-vector); l is
+    the likelihood with the products of the elements by their
+    logarithm or NULL to compute them on the fly. The result and
+    the buffers, of mult(s)/s[0]/s[N] elements, are taken from
+    the arena a */
+    T *HDotTTV(T **xt, likelihood *l, T *H, Arena& a)
+    {
+      T *_q = a.Alloc<T>(s[0]);
+
+      ArenaScope scope(a);
+
+      /* number of state factors */
+      std::size_t n = s.size()-1;
+
+      std::size_t offset = mult(s)/s[0];
+      std::size_t m = offset/s[n];
+
+      T *y = a.Alloc<T>(m);
+      T *h = a.Alloc<T>(m);
+
+      typename accumulator<T>::type sum_H = 0;
+
+      for (std::size_t k = 0; k < s[0]; ++k)
+      {
+        T *_t = &t[offset*k];
+        std::size_t d = s[n];
+
+        /* last state factor, together with the entropy term */
+        for (std::size_t r = 0; r < m; ++r)
+          if (l)
+            y[r] = opt_dot<T>(d, &_t[r*d], &l->t[offset*k+r*d], xt[n-1], &h[r]);
+          else
+            y[r] = opt_dot<T>(d, &_t[r*d], xt[n-1], &h[r]);
+
+        /* the other state factors, in place: y[r] only depends on
+           the elements from r*d on */
+        std::size_t mm = m;
+        for (std::size_t i = n-1; i-- > 0; )
+        {
+          d = s[i+1];
+          mm /= d;
+
+          for (std::size_t r = 0; r < mm; ++r)
+          {
+            y[r] = opt_dot<T>(d, &y[r*d], xt[i]);
+            h[r] = opt_dot<T>(d, &h[r*d], xt[i]);
+          }
+        }
+
+        _q[k] = y[0];
+        sum_H += h[0];
+      }
+
+      *H = sum_H;
+
+      return _q;
+    }
+
+    /* likelihood of the outcome o along dimension f marginalised
+    over the other state factors: v[i] is the sum of the products
+    of the elements t(o,...,i,...) and the vectors xt[j], j != f */
+    void Marginal(std::size_t o, T **xt, std::size_t f, T *v)
+    {
+      /* number of state factors */
+      std::size_t n = s.size()-1;
+
+      std::size_t m = mult(s)/s[0];
+
+      for (std::size_t i = 0; i < s[f+1]; i++)
+        v[i] = 0.0;
+
+      std::vector<std::size_t> indices(n, 0);
+
+      auto a = &t[o*m];
+
+      for (std::size_t j = 0; j < m; j++)
+      {
+        if (a[j] != 0.0)
+        {
+          T product = a[j];
+
+          for (std::size_t i = 0; i < n; i++)
+            if (i != f)
+              product *= xt[i][indices[i]];
+
+          v[indices[f]] += product;
+        }
+
+        /* move to the next element of the state factors */
+        for (std::size_t i = n; i-- > 0; )
+        {
+          if (++indices[i] < s[i+1])
+            break;
+          indices[i] = 0;
+        }
+      }
+    }
+
     /* find the likelihood elements t(:,sq[0],...,sq[Nf-1])
     and store them in the vector p */
     void find(std::vector<int> sq, std::vector<T> &p)
@@ -545,7 +871,7 @@ namespace detail
         std::size_t ind = k;
 
         for (std::size_t j = 0; j < sq.size(); ++j)
-	  ind = ind * s[j+1] + sq[j];
+	  ind = ind * s[j+1] + broadcast(j, sq[j]);
 
         p.at(k) = t[ind];
       }
@@ -622,6 +948,38 @@ namespace detail
       return y;
     }
 
+    /* Multidimensional cross (outer) product, serial version
+       taking the result from the arena a: the product is expanded
+       in place one array at a time, starting from the last element
+       (y[j] is read before the block y[j*d...] is written) */
+    T *cross(T **arr, Arena& a)
+    {
+      /* number of arrays */
+      std::size_t n = s.size()-1;
+
+      T *y = a.Alloc<T>(mult(s)/s[0]);
+
+      std::size_t m = s[1];
+      for (std::size_t i = 0; i < m; i++)
+        y[i] = arr[0][i];
+
+      for (std::size_t i = 1; i < n; i++)
+      {
+        std::size_t d = s[i+1];
+
+        for (std::size_t j = m; j-- > 0; )
+        {
+          T product = y[j];
+
+          opt_scale<T>(d, product, arr[i], &y[j*d]);
+        }
+
+        m *= d;
+      }
+
+      return y;
+    }
+
     /* Multidimensional cross (outer) product */
     void cross(unsigned int d, unsigned int tt, std::vector<Beliefs<T>*> &_X)
     {
@@ -639,7 +997,7 @@ namespace detail
       if (n == 1)
       {
         for (std::size_t i = 0; i < m; i++)
-          t[_offset+i] = _X[0]->getValue(i,tt); 
+          t[_offset+i] = belief(_X, 0, i, tt);
         return;
       }
 
@@ -661,10 +1019,10 @@ namespace detail
 
         for (std::size_t count = 0; count < m2; count++) {
           /* compute current product */
-          T product = _X[0]->getValue(indices[0],tt);
+          T product = belief(_X, 0, indices[0], tt);
 
           for (std::size_t i = 1; i < n; i++)
-            product *= _X[i]->getValue(indices[i],tt);
+            product *= belief(_X, i, indices[i], tt);
 
           //std::cout << "index = " << _offset+j*m2+count << " product = " << product << std::endl;
           t[_offset+j*m2+count] = product;
@@ -696,6 +1054,64 @@ namespace detail
       return;
     }
 
+    /* add e times the cross (outer) product of the beliefs at time tt
+       to the non-zero elements of the slice of outcome d, in a single
+       pass and without temporaries (Dirichlet counts of the observed
+       outcome): same as cross, multiplies and sum */
+    void add_cross(unsigned int d, unsigned int tt, std::vector<Beliefs<T>*> &_X, T e)
+    {
+      /* number of arrays */
+      std::size_t n = s.size()-1;
+
+      std::size_t m = s[1];
+      for (std::size_t i = 2; i <= n; i++)
+        m *= s[i];
+
+      T *a = &t[m * d];
+      std::size_t m2 = m/s[1];
+
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+      for (std::size_t j = 0; j < s[1]; j++)
+      {
+        /* next element in each of the n arrays and products
+           of the elements of the arrays up to each of them */
+        std::size_t indices[sizeof...(Iseq)];
+        T pre[sizeof...(Iseq)];
+
+        indices[0] = j;
+        pre[0] = belief(_X, 0, j, tt);
+        for (std::size_t i = 1; i < n; i++)
+        {
+          indices[i] = 0;
+          pre[i] = pre[i-1] * belief(_X, i, 0, tt);
+        }
+
+        T *aj = &a[j*m2];
+        for (std::size_t count = 0; count < m2; count++) {
+          if (aj[count] > 0)
+            aj[count] += pre[n-1] * e;
+
+          /* rightmost array that has more elements left */
+          std::size_t next = n - 1;
+          while (next >= 1 && indices[next] + 1 >= s[next+1])
+            next--;
+
+          if (next >= 1) {
+            indices[next]++;
+            pre[next] = pre[next-1] * belief(_X, next, indices[next], tt);
+
+            for (std::size_t i = next + 1; i < n; i++)
+            {
+              indices[i] = 0;
+              pre[i] = pre[i-1] * belief(_X, i, 0, tt);
+            }
+          }
+        }
+      }
+    }
+
     /* fill up the array elements applying a mask to the first likelihood object
        array; the mask is obtained by comparing each element of the second likelihood
        object array with zero */
@@ -722,6 +1138,22 @@ namespace detail
       }
       return ind;
     }
+
+    /* index j of state factor i: a state factor with a dimension
+       of size 1 is one the outcomes do not depend on, and all its
+       states are mapped (broadcast) to index 0 */
+    std::size_t broadcast(std::size_t i, std::size_t j) const
+    {
+      return (s[i+1] == 1) ? 0 : j;
+    }
+
+    /* belief of state factor i in state j at time step tt; over a
+       dimension of size 1 the (normalized) belief is marginalised */
+    T belief(std::vector<Beliefs<T>*> &_X, std::size_t i, std::size_t j,
+             unsigned int tt)
+    {
+      return (s[i+1] == 1) ? 1.0 : _X[i]->getValue(j,tt);
+    }
  
     std::size_t mult(const std::array<std::size_t, sizeof...(Iseq)>& a)
     {
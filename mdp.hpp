@@ -37,6 +37,9 @@
 #include <algorithm>
 #include <stdlib.h>
 #include <random>
+#include <map>
+#include <limits>
+#include <functional>
 #include "states.hpp"
 #include "beliefs.hpp"
 #include "transitions.hpp"
@@ -45,7 +48,12 @@
 #include "constants.h"
 #include "util.hpp"
 #include "construct_policies.hpp"
+#include "policy_trie.hpp"
 #include "common.h"
+#include "arena.hpp"
+#ifdef SPARSE_LIKELIHOOD
+#include "sparse_likelihood.hpp"
+#endif
 //#ifdef _OPENMP
 //#include "omp.h"
 //#endif
@@ -63,6 +71,7 @@ template <typename Ty, std::size_t M>
 class MDP {
 protected:
   unsigned int T; /* temporal horizon */
+  unsigned int Tw; /* time steps held by the histories */
   Ty alpha; /* gamma hyperparameter */
   Ty beta; /* gamma hyperparameter */
   Ty lambda; /* precision update rate */
@@ -75,7 +84,7 @@ protected:
   std::vector<unsigned int> Ns;
   unsigned int Nu; /* number of hidden controls */
   std::vector<unsigned int> No; /* number of outcomes */
-  std::vector<std::vector<int>> _V; /* policies */
+  Policies _V; /* policies */
   std::vector<Beliefs<Ty>*> _lnD;
   std::vector<States*> _S; /* real state in the world */
   std::vector<std::vector<Transitions<Ty>*> > _B;
@@ -84,10 +93,45 @@ protected:
   std::vector<std::vector<likelihood<Ty,M>*> > _AA;
 #endif
 #ifndef NO_PRECOMPUTE_ALOGA
-  std::vector<std::vector<likelihood<Ty,M>*> > _AlogA;
+  std::vector<std::vector<likelihood<Ty,M>*> > _AlogA; /* NULL for the sparse likelihoods */
 #endif
   std::vector<Priors<Ty>*> _lnC;
   std::vector<likelihood<Ty,M>*> Au;
+#ifdef SPARSE_LIKELIHOOD
+  /* sparse copies of the likelihoods (and of Au) whose density is
+     at most SPARSE_LIKELIHOOD_DENSITY, NULL for the others; an Au
+     summed over the actions is only kept in the sparse copy (Au[g]
+     NULL) */
+  std::vector<std::vector<sparse_likelihood<Ty>*> > _As;
+  std::vector<sparse_likelihood<Ty>*> _Aus;
+#endif
+  /* log-domain copies of the likelihoods (and of Au) and of the
+     transitions read by the state inference: computed at their
+     first use and dropped by update_A and update_B (NULL if not
+     computed); the sparse likelihoods have none */
+  std::vector<std::vector<likelihood<Ty,M>*> > _lnA;
+  std::vector<likelihood<Ty,M>*> _lnAu;
+  std::vector<std::vector<Transitions<Ty>*> > _lnB;
+  /* the model (likelihoods, transitions, priors and the tensors
+     derived from them) is shared with the MDP this one was cloned
+     from, which owns it */
+  bool _shared;
+  /* compile() has run: the model may be read by clones and is not
+     to be changed any more */
+  bool _compiled;
+  /* first modality whose likelihood has the same state factor
+     dimensions, which the joint hidden state belief is shared with */
+  std::vector<unsigned int> _Aj;
+  /* _Ad[g][i] is false if the outcomes of modality g do not depend
+     on the state factor i, i.e. if the likelihood has a dimension
+     of size 1 for it (broadcast over the states of the factor) */
+  std::vector<std::vector<bool>> _Ad;
+#ifdef LEARNING
+  /* _Astale[g] is true if update_A added counts to the likelihoods
+     of modality g of the model itself: they are normalised and the
+     tensors derived from them rebuilt at their next use */
+  std::vector<bool> _Astale;
+#endif
   std::vector<Beliefs<Ty>*> _X;
   std::vector<int> U; /* action selected each time */
   std::mt19937 generator;
@@ -97,9 +141,47 @@ protected:
 #ifdef FULL
   std::vector<unsigned int> _wt; /* indices of allowable policies */
 #endif
+  /* expected free energy of the actions of the beliefs already
+     visited by the tree search, by depth */
+  std::map<std::vector<long long>, std::vector<Ty>> _Gx;
 #ifdef LEARNING
   std::vector<std::vector<std::vector<std::vector<Ty>>>> _xt;
 #endif
+#ifndef FULL
+  /* number of steps taken by step; the states are inferred from
+     the beliefs instead of the true states */
+  unsigned int _step;
+  bool _online;
+#endif
+  /* number of steps taken in the episode, by active_inference or
+     step */
+  unsigned int _steps;
+
+  Ty **modality_beliefs(unsigned int g, Ty **x, Arena& a);
+  likelihood<Ty,M> *lnA(unsigned int g, int act);
+  Transitions<Ty> *lnB(unsigned int f, int act);
+  void clear_lnA();
+  void clear_lnB();
+  void init_histories();
+#ifdef LEARNING
+  void refresh_A();
+#endif
+#ifndef FULL
+  void mean_field_likelihood(unsigned int f, unsigned int t, Ty **x, std::vector<Ty>& v);
+  void shift(unsigned int w, unsigned int t0);
+  unsigned int observe(const std::vector<unsigned int>& obs);
+#endif
+  void policy_posterior(unsigned int tt, std::vector<Ty>& G);
+  void expected_free_energy(Ty **x, int action,
+                            typename accumulator<Ty>::type& G,
+                            std::vector<std::vector<Ty>> *qo = NULL);
+  void forward_search(std::vector<std::vector<Ty>>& x, unsigned int depth,
+                      std::vector<Ty>& G);
+#ifdef BATCHED_AGENTS
+  static void expected_free_energy_batch(std::vector<MDP<Ty,M>*>& m,
+                                         Ty ***x, int action,
+                                         typename accumulator<Ty>::type *G);
+#endif
 
 public:
   unsigned int Nf;
@@ -125,15 +207,35 @@ public:
 #endif
       unsigned int seed_ = 0);
 
+  MDP(MDP<Ty,M>& m, /* model shared */
+      std::vector<States*>& __S, /* true initial state */
+      unsigned int seed_ = 0);
+
+  void compile();
   virtual int get_st(unsigned int f, unsigned int t, int action);
   virtual void logBtimesX(unsigned int f, unsigned int t, std::vector<Ty> &v);
   virtual void marginal_likelihood(unsigned int f, unsigned int t, std::vector<int>& sq, std::vector<Ty>& v);
   void infer_states(unsigned int t);
   std::vector<Ty> infer_policies(unsigned int t);
+  std::vector<Ty> infer_policies_tree(unsigned int t);
   int sample_action(unsigned int t);
   void sample_state(unsigned int t, int action);
   void sample_observation(unsigned int t, int action);
   virtual void active_inference();
+  virtual bool episode_end(int a, int t);
+#ifndef FULL
+  int step(const std::vector<unsigned int>& obs);
+#endif
+#ifdef BATCHED_AGENTS
+  static void infer_policies_batch(std::vector<MDP<Ty,M>*>& m,
+                                   const std::vector<unsigned int>& tt,
+                                   unsigned int nt = 1);
+  static void active_inference_batch(std::vector<MDP<Ty,M>*>& m,
+                                     unsigned int nt = 1);
+  static void step_batch(std::vector<MDP<Ty,M>*>& m,
+                         const std::vector<std::vector<unsigned int>>& obs,
+                         std::vector<int>& u, unsigned int nt = 1);
+#endif
   std::vector<std::vector<likelihood<Ty,M>*>>& update_A(
                 std::vector<std::vector<likelihood<Ty,M>*>>& _a,
                 Ty eta, unsigned int tt);
@@ -145,20 +247,53 @@ public:
   std::vector<Beliefs<Ty>*>& update_D(std::vector<Beliefs<Ty>*>& _d,
                 Ty eta, unsigned int tt);
   int getU(unsigned int t) { return this->U[t]; }
+  unsigned int getT() { return this->T; }
+  unsigned int getTw() { return this->Tw; }
+  unsigned int getSteps() { return this->_steps; }
+
+#ifdef STREAMING
+  /* values of a time step leaving the histories */
+  struct Record {
+    unsigned int t; /* time step */
+    int u; /* action */
+    std::vector<int> o; /* outcomes */
+    std::vector<std::vector<Ty>> x; /* expectations of hidden states */
+    std::vector<Ty> P; /* posterior beliefs about control */
+    Ty W; /* posterior precision */
+  };
+
+  /* called (if set) with each time step leaving the histories */
+  std::function<void(const Record&)> sink;
+#endif
 
   virtual ~MDP() {
+    std::for_each(_X.begin(), _X.end(), delete_pointed_to<Beliefs<Ty>>);
+    std::for_each(_O.begin(), _O.end(), delete_pointed_to<States>);
+#ifdef STREAMING
+    std::for_each(_S.begin(), _S.end(), delete_pointed_to<States>);
+#endif
+    if (_shared)
+      return;
+
     std::for_each(_lnD.begin(), _lnD.end(), delete_pointed_to<Beliefs<Ty>>);
     std::for_each(_lnC.begin(), _lnC.end(), delete_pointed_to<Priors<Ty>>);
-    std::for_each(_X.begin(), _X.end(), delete_pointed_to<Beliefs<Ty>>);
     if (Au.size() != 0)
       for (unsigned int g = 0; g < Ng; g++)
         if (_A[g].size() > 1)
           delete Au[g];
-    std::for_each(_O.begin(), _O.end(), delete_pointed_to<States>);
+#ifdef SPARSE_LIKELIHOOD
+    for (unsigned int g = 0; g < _As.size(); g++)
+      std::for_each(_As[g].begin(), _As[g].end(), delete_pointed_to<sparse_likelihood<Ty>>);
+    std::for_each(_Aus.begin(), _Aus.end(), delete_pointed_to<sparse_likelihood<Ty>>);
+#endif
 #ifndef NO_PRECOMPUTE_ALOGA
     for (unsigned int g = 0; g < Ng; g++)
       std::for_each(_AlogA[g].begin(), _AlogA[g].end(), delete_pointed_to<likelihood<Ty,M>>);
 #endif
+    /* the model is released */
+    _compiled = false;
+    clear_lnA();
+    clear_lnB();
   }
 
   Ty generateRand()
@@ -206,34 +341,70 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
   policy_len(policy_len_),
 #endif
   seed(seed_) {
+#ifdef STREAMING
+  /* only the last STREAMING_WINDOW time steps are held */
+  Tw = (STREAMING_WINDOW < 2) ? 2 : STREAMING_WINDOW;
+#else
+  Tw = T;
+#endif
+
   Ng = __A.size(); /* number of outcome factors */
   Nf = __S.size(); /* number of hidden-states factors */
   Nu = __B[0].size(); /* number of hidden controls */
 
   if (__V.size() != 0)
   {
-    _V = __V;
+    _V = Policies(__V);
   }
+#ifndef TREE_SEARCH
   else
 #ifdef FULL
-    _V = construct_policies(Nu, T);
+    _V = Policies(Nu, T);
 #else
-    _V = construct_policies(Nu, (int) policy_len);
+    _V = Policies(Nu, policy_len);
+#endif
 #endif
 
-  Np = _V[0].size();
+  /* the tree search does not enumerate the policies */
+  if (_V.get_np() > std::numeric_limits<unsigned int>::max())
+  {
+    std::cerr << "the number of policies " << _V.get_np() << " is too large" << std::endl;
+    exit(-1);
+  }
+  Np = _V.get_np();
 
-#ifdef DEBUG
-  std::cout << "MDP: Nf=" << Nf << " Ng=" << Ng << " Nu=" << Nu << std::endl;
+  /* explicit policies: as many actions for each policy, at least
+     as many steps as evaluated, each one an action of __B */
+  if (__V.size() != 0)
+  {
 #ifdef FULL
-  for (unsigned int j = 0; j < T; j++)
+    unsigned int V_len = T;
 #else
-  for (unsigned int j = 0; j < policy_len; j++)
+    unsigned int V_len = policy_len;
 #endif
+    bool valid = (__V.size() >= V_len);
+
+    for (unsigned int j = 0; j < __V.size() && valid; j++)
+    {
+      valid = (__V[j].size() == Np);
+      for (unsigned int k = 0; k < __V[j].size() && valid; k++)
+        valid = (__V[j][k] >= 0 && __V[j][k] < (int) Nu);
+    }
+
+    if (!valid)
+    {
+      std::cerr << "policies __V and transition probabilities __B are not consistent" << std::endl;
+      exit(-1);
+    }
+  }
+
+#ifdef DEBUG
+  std::cout << "MDP: Nf=" << Nf << " Ng=" << Ng << " Nu=" << Nu << std::endl;
+  for (unsigned int j = 0; j < _V.get_length(); j++)
   {
     std::cout << "MDP: V[" << j << "] = ";
-    for (int val: _V[j]) {
-      std::cout << val << " ";
+    for (unsigned int k = 0; k < Np; k++) {
+      std::cout << _V(j,k) << " ";
     }
     std::cout << std::endl;
   }
@@ -301,11 +472,16 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
 
       __B[i][j]->Norm();
 
+      /* column accesses of get_st */
+      if (!__B[i][j]->has_csc())
+        __B[i][j]->CSC();
+
       //b1.push_back(new Transitions<Ty>(*__B[i][j]));
       b1.push_back(__B[i][j]);
     }
 
     _B.push_back(b1);
+    _lnB.push_back(std::vector<Transitions<Ty>*>(b1.size(), NULL));
 
 #ifdef DEBUG
     for (unsigned int j = 0; j < _B[i].size(); j++)
@@ -316,12 +492,15 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
 #endif
 
     /* expectations of hidden states */
-    _X.push_back(new Beliefs<Ty>(Ns[i],T));
+    _X.push_back(new Beliefs<Ty>(Ns[i],Tw));
     _X[i]->Zeros();
   }
 
   for (unsigned int g = 0; g < Ng; g++) {
     std::vector<likelihood<Ty,M>*> a1;
+#ifdef SPARSE_LIKELIHOOD
+    std::vector<sparse_likelihood<Ty>*> as1;
+#endif
 #ifndef NO_PRECOMPUTE_ALOGA
     std::vector<likelihood<Ty,M>*> a2;
 #endif
@@ -372,7 +551,7 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
       }
 
       for (unsigned int i = 0; i < Nf; i++)
-        if (Ns[i] != dims[i+1]) {
+        if (Ns[i] != dims[i+1] && dims[i+1] != 1) {
           std::cerr << "__A and __D are not consistent" << std::endl;
           exit(-1);
         }
@@ -385,7 +564,18 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
 
       //a1.push_back(new likelihood<Ty,M>(*__A[g][j]));
       a1.push_back(__A[g][j]);
+#ifdef SPARSE_LIKELIHOOD
+      /* sparse format for the likelihoods with few non-zero elements */
+      as1.push_back((sparse_likelihood<Ty>::density(*__A[g][j]) <= SPARSE_LIKELIHOOD_DENSITY) ?
+                    new sparse_likelihood<Ty>(*__A[g][j]) : NULL);
+#endif
 #ifndef NO_PRECOMPUTE_ALOGA
+      /* none for the sparse likelihoods, which compute it themselves */
+#ifdef SPARSE_LIKELIHOOD
+      if (as1.back())
+        a2.push_back(NULL);
+      else
+#endif
       a2.push_back(new likelihood<Ty,M>(__A[g][j]->AlogA()));
 #endif
 #ifdef WITH_GP
@@ -395,9 +585,14 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
     }
 
     _A.push_back(a1);
+    _lnA.push_back(std::vector<likelihood<Ty,M>*>(a1.size(), NULL));
+    _lnAu.push_back(NULL);
 #ifndef NO_PRECOMPUTE_ALOGA
     _AlogA.push_back(a2);
 #endif
+#ifdef SPARSE_LIKELIHOOD
+    _As.push_back(as1);
+#endif
 #ifdef WITH_GP
     _AA.push_back(aa1);
 #endif
@@ -415,6 +610,20 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
     //No.push_back(__A[g][0]->get_firstdimension());
     No.push_back(_lnC[g]->get_size());
 
+    /* modalities with the same state factor dimensions share
+       the joint hidden state belief */
+    auto sg = _A[g][0]->GetIndexArray();
+    unsigned int h = 0;
+    while (h < g && !std::equal(sg.begin()+1, sg.end(),
+                                _A[h][0]->GetIndexArray().begin()+1))
+      h++;
+    _Aj.push_back(h);
+
+    std::vector<bool> dg(Nf);
+    for (unsigned int i = 0; i < Nf; i++)
+      dg[i] = (sg[i+1] != 1 || Ns[i] == 1);
+    _Ad.push_back(dg);
+
 #ifdef DEBUG
     std::cout << "MDP: _lnC[" << g << "] = ";
     for (unsigned int e = 0; e < No[g]; e++)
@@ -441,6 +650,13 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
       Au.push_back(_au1);
     }
 
+#ifdef SPARSE_LIKELIHOOD
+    if (sparse_likelihood<Ty>::density(*Au[g]) <= SPARSE_LIKELIHOOD_DENSITY)
+      _Aus.push_back(new sparse_likelihood<Ty>(*Au[g]));
+    else
+      _Aus.push_back(NULL);
+#endif
+
 #ifdef DEBUG
     std::cout << "MDP: Au[" << g << "] = ";
     for (unsigned int e = 0; e < Au[g]->get_tnc(); e++)
@@ -461,20 +677,136 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
 #endif
 
     /* initial outcomes */
-    _O.push_back(new States(T));
+    _O.push_back(new States(Tw));
     _O[g]->Set(q);
+
+#ifdef SPARSE_LIKELIHOOD
+    /* only the sparse copy is kept of the Au summed here */
+    if (_Aus[g] && _A[g].size() > 1)
+    {
+      delete Au[g];
+      Au[g] = NULL;
+    }
+#endif
+  }
+
+  _shared = false;
+  _compiled = false;
+
+  init_histories();
+}
+
+/* clone sharing the model of m (built once, read only): only the
+   expectations of hidden states, the histories and the random number
+   generator are allocated; m must outlive the clone */
+template <typename Ty, std::size_t M>
+MDP<Ty,M>::MDP(MDP<Ty,M>& m,
+  std::vector<States*>& __S,
+  unsigned int seed_) :
+  T(m.T),
+  Tw(m.Tw),
+  alpha(m.alpha),
+  beta(m.beta),
+  lambda(m.lambda),
+  gamma(m.gamma),
+  N(m.N),
+#ifndef FULL
+  policy_len(m.policy_len),
+#endif
+  seed(seed_) {
+  if (__S.size() != m.Nf)
+  {
+    std::cerr << "true initial state __S and the model are not consistent" << std::endl;
+    exit(-1);
+  }
+
+  /* the log-domain copies are built before being shared */
+  m.compile();
+
+  Nf = m.Nf;
+  Ng = m.Ng;
+  Nu = m.Nu;
+  Np = m.Np;
+  Ns = m.Ns;
+  No = m.No;
+  _V = m._V;
+  _lnD = m._lnD;
+  _lnC = m._lnC;
+  _B = m._B;
+  _A = m._A;
+#ifdef WITH_GP
+  _AA = m._AA;
+#endif
+#ifndef NO_PRECOMPUTE_ALOGA
+  _AlogA = m._AlogA;
+#endif
+  Au = m.Au;
+#ifdef SPARSE_LIKELIHOOD
+  _As = m._As;
+  _Aus = m._Aus;
+#endif
+  _lnA = m._lnA;
+  _lnAu = m._lnAu;
+  _lnB = m._lnB;
+  _Aj = m._Aj;
+  _Ad = m._Ad;
+  _S = __S;
+  _shared = true;
+  _compiled = true;
+
+  std::vector<std::size_t> s;
+
+  for (unsigned int i = 0; i < Nf; i++)
+  {
+    s.push_back(_S[i]->StateFind());
+
+    _X.push_back(new Beliefs<Ty>(Ns[i],Tw));
+    _X[i]->Zeros();
+  }
+
+  /* initial outcomes */
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    _O.push_back(new States(Tw));
+#ifdef SPARSE_LIKELIHOOD
+    if (!Au[g])
+      _O[g]->Set(_Aus[g]->MaxIndex(s));
+    else
+#endif
+    _O[g]->Set(Au[g]->MaxIndex(s));
+  }
+
+  init_histories();
+}
+
+/* histories of the time steps, initial states and outcomes */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::init_histories()
+{
+#ifdef STREAMING
+  /* the true states of the last Tw time steps, owned: only the
+     initial state of __S is read */
+  for (unsigned int i = 0; i < Nf; i++)
+  {
+    States *s = new States(Tw);
+    s->Zeros();
+    s->Set(_S[i]->Get());
+    _S[i] = s;
   }
+#endif
 
-  U.resize(T, -1);
+  U.resize(Tw, -1);
 
-  _st.resize(T, std::vector<int>(Nf, -1));
-  _ot.resize(T, std::vector<int>(Ng, -1));
-  _ut.resize(T, std::vector<Ty>(Np, 0));
-  _P.resize(T, std::vector<Ty>(Nu, 0));
-  _W.resize(T, 0);
+  _st.resize(Tw, std::vector<int>(Nf, -1));
+  _ot.resize(Tw, std::vector<int>(Ng, -1));
+  _ut.resize(Tw, std::vector<Ty>(Np, 0));
+  _P.resize(Tw, std::vector<Ty>(Nu, 0));
+  _W.resize(Tw, 0);
 #ifdef LEARNING
-  _xt.resize(T);
-  for (unsigned int i = 0; i < T; i++)
+  _Astale.resize(Ng, false);
+
+  _xt.resize(Tw);
+  for (unsigned int i = 0; i < Tw; i++)
   {
     _xt[i].resize(Np);
     for (unsigned int j = 0; j < Np; j++)
@@ -489,6 +821,35 @@ MDP<Ty,M>::MDP(std::vector<Beliefs<Ty>*>& __D,
     _ot[0][g] = _O[g]->Get();
 
   generator.seed(seed);
+
+#ifndef FULL
+  _step = 0;
+  _online = false;
+#endif
+  _steps = 0;
+}
+
+/* build the log-domain copies otherwise computed at their first use,
+   so that the model can be read concurrently by its clones */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::compile()
+{
+  for (unsigned int g = 0; g < Ng; g++)
+    for (int act = -1; act < (int) _A[g].size(); act++)
+    {
+#ifdef SPARSE_LIKELIHOOD
+      /* the sparse likelihoods have none */
+      if ((act < 0) ? _Aus[g] : _As[g][act])
+        continue;
+#endif
+      lnA(g, act);
+    }
+
+  for (unsigned int f = 0; f < Nf; f++)
+    for (unsigned int act = 0; act < _B[f].size(); act++)
+      lnB(f, act);
+
+  _compiled = true;
 }
 
 template <typename Ty, std::size_t M>
@@ -498,24 +859,21 @@ int MDP<Ty,M>::get_st(unsigned int f, unsigned int t, int action)
   std::cout << "get_st: t=" << t << " action=" << action << " _S[" << f << "]->StateFind(" << t << ")=" << _S[f]->StateFind(t) << std::endl;
 #endif
 
-#ifdef SAMPLE_AS_MAX
-  int act_u = _B[f].size() == 1 ? 0 : action;
-  return _B[f][act_u]->MaxIndex(_S[f]->StateFind(t));
-#else
-  std::vector<Ty> ps(Ns[f], 0.0);
-
   int act_u = _B[f].size() == 1 ? 0 : action;
-  _B[f][act_u]->extract_column(_S[f]->StateFind(t),ps);
+  unsigned int c = _S[f]->StateFind(t);
 
 #ifdef DEBUG
   std::cout << "get_st: ps = ";
-  for (Ty val: ps) {
-    std::cout << val << " ";
-  }
+  for (unsigned int k = 0; k < _B[f][act_u]->get_col_nnz(c); k++)
+    std::cout << "(" << _B[f][act_u]->get_col_row(c,k) << ") "
+              << _B[f][act_u]->get_col_value(c,k) << " ";
   std::cout << std::endl;
 #endif
 
-  return CDFs<Ty>(ps, generateRand());
+#ifdef SAMPLE_AS_MAX
+  return _B[f][act_u]->MaxIndex(c);
+#else
+  return _B[f][act_u]->Sample(c, generateRand());
 #endif
 }
 
@@ -523,108 +881,417 @@ template <typename Ty, std::size_t M>
 void MDP<Ty,M>::logBtimesX(unsigned int f, unsigned int t, std::vector<Ty>& v)
 {
   int act_ut = _B[f].size() == 1 ? 0 : U[t-1];
-  _B[f][act_ut]->logTxv(_X[f]->getArray(t-1), v);
+  lnB(f, act_ut)->lnTxv(_X[f]->getArray(t-1), v);
 }
 
+/* log-domain copy of the likelihood of modality g under the
+   action act (of Au[g] if act < 0), computed at the first call */
 template <typename Ty, std::size_t M>
-void MDP<Ty,M>::marginal_likelihood(unsigned int f, unsigned int tt, std::vector<int>& sq, std::vector<Ty>& v)
+likelihood<Ty,M> *MDP<Ty,M>::lnA(unsigned int g, int act)
 {
-  for (unsigned int g = 0; g < Ng; g++)
+  /* Au[g] is the likelihood itself if it does not depend on
+     the action */
+  if (act < 0 && _A[g].size() == 1)
+    act = 0;
+
+  likelihood<Ty,M> *&l = (act < 0) ? _lnAu[g] : _lnA[g][act];
+
+  if (!l)
+    l = ((act < 0) ? Au[g] : _A[g][act])->Log();
+
+  return l;
+}
+
+/* log-domain copy of the transitions of factor f under the
+   action act, computed at the first call */
+template <typename Ty, std::size_t M>
+Transitions<Ty> *MDP<Ty,M>::lnB(unsigned int f, int act)
+{
+  if (!_lnB[f][act])
+    _lnB[f][act] = _B[f][act]->Log();
+
+  return _lnB[f][act];
+}
+
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::clear_lnA()
+{
+  /* the model shared is read only */
+  if (_shared)
+    return;
+
+  if (_compiled)
   {
-    Ty **Ag = NULL;
+    std::cerr << "clear_lnA: the model of a compiled MDP is read only" << std::endl;
+    exit(-1);
+  }
 
-    if (tt > 0)
+  for (unsigned int g = 0; g < _lnA.size(); g++)
+  {
+    for (auto& l: _lnA[g])
     {
-      int act_ut = _A[g].size() == 1 ? 0 : U[tt-1];
-      Ag = _A[g][act_ut]->Dot(sq,f);
+      delete l;
+      l = NULL;
     }
-    else
-      Ag = Au[g]->Dot(sq,f);
 
-#ifdef DEBUG
-    std::cout << "marginal_likelihood: tt=" << tt << " f=" << f << " g=" << g << " Ag = ";
-    for (std::size_t k = 0; k < _A[g][0]->get_firstdimension(); k++)
+    delete _lnAu[g];
+    _lnAu[g] = NULL;
+  }
+}
+
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::clear_lnB()
+{
+  if (_shared)
+    return;
+
+  if (_compiled)
+  {
+    std::cerr << "clear_lnB: the model of a compiled MDP is read only" << std::endl;
+    exit(-1);
+  }
+
+  for (unsigned int f = 0; f < _lnB.size(); f++)
+    for (auto& l: _lnB[f])
     {
-      for(unsigned int ii = 0; ii < Ns[f]; ii++)
-        std::cout << Ag[k][ii] << " ";
-      std::cout << std::endl;
+      delete l;
+      l = NULL;
     }
-#endif
+}
 
-    for(unsigned int ii = 0; ii < Ns[f]; ii++)
-      v[ii] += _log(Ag[_O[g]->StateFind(tt)][ii]);
+#ifndef FULL
+/* likelihood of the outcomes observed at time t marginalised over
+   the beliefs x of the state factors other than f */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::mean_field_likelihood(unsigned int f, unsigned int tt, Ty **x, std::vector<Ty>& v)
+{
+  Arena& a = scratch();
+  ArenaScope scope(a);
+
+  Ty *v_g = a.Alloc<Ty>(Ns[f]);
+
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    std::size_t o = _O[g]->StateFind(tt);
+    int act_ut = (tt == 0) ? -1 : (_A[g].size() == 1 ? 0 : U[tt-1]);
+    Ty **xg = modality_beliefs(g, x, a);
+
+#ifdef SPARSE_LIKELIHOOD
+    sparse_likelihood<Ty> *As = (act_ut < 0) ? _Aus[g] : _As[g][act_ut];
+
+    if (As)
+      As->Marginal(o, xg, f, v_g);
+    else
+#endif
+    ((act_ut < 0) ? Au[g] : _A[g][act_ut])->Marginal(o, xg, f, v_g);
 
-    for (std::size_t k = 0; k < _A[g][0]->get_firstdimension(); k++)
-      delete [] Ag[k];
-    delete [] Ag;
+    /* the outcomes of g may not depend on the factor f */
+    for (unsigned int ii = 0; ii < Ns[f]; ii++)
+      v[ii] += _log(v_g[_Ad[g][f] ? ii : 0]);
   }
 }
 
+/* slide the first w time steps of the histories by one: the time
+   step t0 at time index 0 leaves them (to the sink with macro
+   STREAMING) and the time index w-1 is freed for the next step */
 template <typename Ty, std::size_t M>
-void MDP<Ty,M>::infer_states(unsigned int tt)
+void MDP<Ty,M>::shift(unsigned int w, unsigned int t0)
 {
-  std::vector<int> sq;
+#ifdef STREAMING
+  if (sink)
+  {
+    Record r;
+    r.t = t0;
+    r.u = U[0];
+    r.o = _ot[0];
+    for (unsigned int i = 0; i < Nf; i++)
+      r.x.push_back(std::vector<Ty>(_X[i]->getArray(0), _X[i]->getArray(0)+Ns[i]));
+    r.P = _P[0];
+    r.W = _W[0];
+
+    sink(r);
+  }
+#else
+  (void) t0;
+#endif
 
   for (unsigned int i = 0; i < Nf; i++)
-    sq.push_back(_S[i]->StateFind(tt));
+    std::copy(_X[i]->getArray(1), _X[i]->getArray(w), _X[i]->getArray(0));
 
-#ifdef DEBUG
-  std::cout << "infer_states: tt=" << tt << " sq = ";
-  for (unsigned int val: sq) {
-    std::cout << val << " ";
+  for (unsigned int j = 1; j < w; j++)
+  {
+    for (unsigned int g = 0; g < Ng; g++)
+      _O[g]->Set(_O[g]->Get(j), j-1);
+
+    /* the true states are only known without the online steps */
+    if (!_online)
+      for (unsigned int i = 0; i < Nf; i++)
+        _S[i]->Set(_S[i]->Get(j), j-1);
   }
-  std::cout << std::endl;
+
+  /* the rows of the histories are moved, not copied */
+  std::rotate(_st.begin(), _st.begin()+1, _st.begin()+w);
+  std::rotate(_ot.begin(), _ot.begin()+1, _ot.begin()+w);
+  std::rotate(_ut.begin(), _ut.begin()+1, _ut.begin()+w);
+  std::rotate(_P.begin(), _P.begin()+1, _P.begin()+w);
+  std::rotate(U.begin(), U.begin()+1, U.begin()+w);
+  std::rotate(_W.begin(), _W.begin()+1, _W.begin()+w);
+  U[w-1] = -1;
+  _W[w-1] = 0;
+
+#ifdef LEARNING
+  std::rotate(_xt.begin(), _xt.begin()+1, _xt.begin()+w);
+  for (auto& x: _xt[w-1])
+    for (auto& xi: x)
+      xi.clear();
 #endif
+}
 
-  if (tt > 0)
+/* first half of an online step: store the outcomes obs of the
+   current step, sliding the histories if needed, infer the hidden
+   states and return the time index of the step */
+template <typename Ty, std::size_t M>
+unsigned int MDP<Ty,M>::observe(const std::vector<unsigned int>& obs)
+{
+  if (obs.size() != Ng)
   {
-#ifdef FULL
-    /* retain allowable policies (that are consistent with last action) */
-    std::vector<unsigned int> __wt(_wt);
+    std::cerr << "step: one outcome for each modality is needed" << std::endl;
+    exit(-1);
+  }
 
-    _wt.clear();
+  if (Tw < 2)
+  {
+    std::cerr << "step: the temporal horizon must be at least 2" << std::endl;
+    exit(-1);
+  }
 
-    for(unsigned int jj = 0; jj < __wt.size(); jj++)
-      if (_V[tt-1][__wt[jj]] == U[tt-1])
-        _wt.push_back(__wt[jj]);
+  _online = true;
+
+#ifdef STREAMING
+  unsigned int w = Tw;
+#else
+  unsigned int w = 2;
 #endif
 
-    /* update policy expectations */
-    Ty _ut_sum = 0.0;
+  unsigned int tt = (_step < w) ? _step : w-1;
+  if (_step >= w)
+    shift(w, _step-w);
 
-#ifdef FULL
-    for (unsigned int val: _wt)
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    _O[g]->Set(obs[g], tt);
+    _ot[tt][g] = obs[g];
+  }
+
+  infer_states(tt);
+
+  return tt;
+}
+
+/* online step: given the outcomes obs of all the modalities at the
+   current step, infer the hidden states and the policies and return
+   the action selected. Only the step before is kept (at time index
+   0, the current one at 1), or the last Tw steps with macro
+   STREAMING, so the cost of a step does not depend on how many were
+   taken and the temporal horizon T only needs to be at least 2 */
+template <typename Ty, std::size_t M>
+int MDP<Ty,M>::step(const std::vector<unsigned int>& obs)
+{
+  unsigned int tt = observe(obs);
+
+#ifdef TREE_SEARCH
+  infer_policies_tree(tt);
 #else
-    for (unsigned int val = 0; val < Np; val++)
+  infer_policies(tt);
 #endif
-      _ut_sum += _ut[tt-1][val];
-#ifdef FULL
-    for (unsigned int val: _wt)
-#else
-    for (unsigned int val = 0; val < Np; val++)
+
+  _step++;
+  _steps++;
+
+  return sample_action(tt);
+}
 #endif
-      _ut[tt][val] = _ut[tt-1][val] / _ut_sum;
-  }
-  else
+
+#ifdef LEARNING
+/* normalise the likelihoods updated in place by update_A and rebuild
+   the tensors derived from them (AlogA, Au, the sparse and the
+   log-domain copies) */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::refresh_A()
+{
+  bool stale = false;
+
+  for (unsigned int g = 0; g < Ng; g++)
   {
-    /* initialise policy expectations */
-    for(unsigned int jj = 0; jj < Np; jj++)
+    if (!_Astale[g])
+      continue;
+
+    for (unsigned int j = 0; j < _A[g].size(); j++)
     {
-#ifdef FULL
-      _wt.push_back(jj);
+      _A[g][j]->Norm();
+#ifdef SPARSE_LIKELIHOOD
+      delete _As[g][j];
+      _As[g][j] = (sparse_likelihood<Ty>::density(*_A[g][j]) <= SPARSE_LIKELIHOOD_DENSITY) ?
+                  new sparse_likelihood<Ty>(*_A[g][j]) : NULL;
+#endif
+#ifndef NO_PRECOMPUTE_ALOGA
+      delete _AlogA[g][j];
+#ifdef SPARSE_LIKELIHOOD
+      if (_As[g][j])
+        _AlogA[g][j] = NULL;
+      else
+#endif
+      _AlogA[g][j] = new likelihood<Ty,M>(_A[g][j]->AlogA());
 #endif
-      _ut[tt][jj] = 1. / Np;
     }
-  }
-#ifdef DEBUG
-#ifdef FULL
-  std::cout << "infer_states: _wt = ";
-  for (unsigned int val: _wt) {
-    std::cout << val << " ";
+
+    if (_A[g].size() > 1)
+    {
+      if (!Au[g])
+        Au[g] = new likelihood<Ty,M>(_A[g][0]->GetIndexArray());
+      Au[g]->Zeros();
+      for (unsigned int j = 0; j < _A[g].size(); j++)
+        Au[g]->sum(*_A[g][j]);
+      Au[g]->Norm();
+    }
+#ifdef SPARSE_LIKELIHOOD
+    delete _Aus[g];
+    _Aus[g] = (sparse_likelihood<Ty>::density(*Au[g]) <= SPARSE_LIKELIHOOD_DENSITY) ?
+              new sparse_likelihood<Ty>(*Au[g]) : NULL;
+
+    if (_Aus[g] && _A[g].size() > 1)
+    {
+      delete Au[g];
+      Au[g] = NULL;
+    }
+#endif
+
+    _Astale[g] = false;
+    stale = true;
+  }
+
+  if (stale)
+    clear_lnA();
+}
+#endif
+
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::marginal_likelihood(unsigned int f, unsigned int tt, std::vector<int>& sq, std::vector<Ty>& v)
+{
+  Arena& a = scratch();
+  ArenaScope scope(a);
+
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    /* only the likelihood of the observed outcome is needed: the
+       fibre along f of the log-domain copy is read in place */
+    std::size_t o = _O[g]->StateFind(tt);
+    int act_ut = (tt == 0) ? -1 : (_A[g].size() == 1 ? 0 : U[tt-1]);
+    fibre<Ty> lnAg;
+
+#ifdef SPARSE_LIKELIHOOD
+    sparse_likelihood<Ty> *As = (act_ut < 0) ? _Aus[g] : _As[g][act_ut];
+
+    if (As)
+    {
+      /* the logarithms of the fibre gathered from the sparse
+         likelihood */
+      Ty *v_g = a.Alloc<Ty>(Ns[f]);
+      lnAg = As->Fibre(o, sq, f, v_g);
+
+      for (std::size_t ii = 0; ii < lnAg.n; ii++)
+        v_g[ii] = _log(v_g[ii]);
+    }
+    else
+#endif
+    lnAg = lnA(g, act_ut)->Fibre(o, sq, f);
+
+#ifdef DEBUG
+    std::cout << "marginal_likelihood: tt=" << tt << " f=" << f << " g=" << g << " o=" << o << " lnAg = ";
+    for (std::size_t ii = 0; ii < lnAg.n; ii++)
+      std::cout << lnAg[ii] << " ";
+    std::cout << std::endl;
+#endif
+
+    /* the outcomes of g may not depend on the factor f */
+    for(unsigned int ii = 0; ii < Ns[f]; ii++)
+      v[ii] += lnAg[_Ad[g][f] ? ii : 0];
+  }
+}
+
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::infer_states(unsigned int tt)
+{
+#ifdef LEARNING
+  refresh_A();
+#endif
+
+  std::vector<int> sq;
+
+#ifndef FULL
+  /* the true states are not known by the online steps */
+  if (!_online)
+#endif
+  for (unsigned int i = 0; i < Nf; i++)
+    sq.push_back(_S[i]->StateFind(tt));
+
+#ifdef DEBUG
+  std::cout << "infer_states: tt=" << tt << " sq = ";
+  for (unsigned int val: sq) {
+    std::cout << val << " ";
+  }
+  std::cout << std::endl;
+#endif
+
+  if (tt > 0)
+  {
+#ifdef FULL
+    /* retain allowable policies (that are consistent with last action) */
+    std::vector<unsigned int> __wt(_wt);
+
+    _wt.clear();
+
+    for(unsigned int jj = 0; jj < __wt.size(); jj++)
+      if (_V(tt-1,__wt[jj]) == U[tt-1])
+        _wt.push_back(__wt[jj]);
+#endif
+
+    /* update policy expectations */
+    Ty _ut_sum = 0.0;
+
+#ifdef FULL
+    for (unsigned int val: _wt)
+#else
+    for (unsigned int val = 0; val < Np; val++)
+#endif
+      _ut_sum += _ut[tt-1][val];
+#ifdef FULL
+    for (unsigned int val: _wt)
+#else
+    for (unsigned int val = 0; val < Np; val++)
+#endif
+      _ut[tt][val] = _ut[tt-1][val] / _ut_sum;
+  }
+  else
+  {
+    /* initialise policy expectations */
+    for(unsigned int jj = 0; jj < Np; jj++)
+    {
+#ifdef FULL
+      _wt.push_back(jj);
+#endif
+      _ut[tt][jj] = 1. / Np;
+    }
+  }
+#ifdef DEBUG
+#ifdef FULL
+  std::cout << "infer_states: _wt = ";
+  for (unsigned int val: _wt) {
+    std::cout << val << " ";
   }
   std::cout << std::endl;
 #endif
-  for (unsigned int j = 0; j < T; j++)
+  for (unsigned int j = 0; j < Tw; j++)
   {
     std::cout << "infer_states: _ut[" << j << "] = ";
     for (Ty val: _ut[j]) {
@@ -634,6 +1301,33 @@ void MDP<Ty,M>::infer_states(unsigned int tt)
   }
 #endif
 
+#ifndef FULL
+  /* online steps: the true states are not known and the likelihood
+     of each factor is marginalised over the predicted beliefs of the
+     others (mean field) */
+  std::vector<std::vector<Ty>> xp;
+  std::vector<Ty*> _xp;
+  if (_online)
+  {
+    xp.resize(Nf);
+    for (unsigned int i = 0; i < Nf; i++)
+    {
+      xp[i].resize(Ns[i]);
+
+      if (tt > 0)
+        _B[i][_B[i].size() == 1 ? 0 : U[tt-1]]->Txv(_X[i]->getArray(tt-1), &xp[i][0]);
+      else
+      {
+        for (unsigned int ii = 0; ii < Ns[i]; ii++)
+          xp[i][ii] = _lnD[i]->getValue(ii);
+        softmax<Ty>(xp[i]);
+      }
+
+      _xp.push_back(&xp[i][0]);
+    }
+  }
+#endif
+
 //#ifdef _OPENMP
 //  #pragma omp parallel for
 //#endif
@@ -642,6 +1336,11 @@ void MDP<Ty,M>::infer_states(unsigned int tt)
     std::vector<Ty> v(Ns[i], 0.0);
 
     /* marginal likelihood over outcome factors */
+#ifndef FULL
+    if (_online)
+      mean_field_likelihood(i, tt, _xp.data(), v);
+    else
+#endif
     marginal_likelihood(i, tt, sq, v);
 
     if (tt > 0)
@@ -682,180 +1381,1035 @@ void MDP<Ty,M>::infer_states(unsigned int tt)
 }
 
 template <typename Ty, std::size_t M>
-std::vector<Ty> MDP<Ty,M>::infer_policies(unsigned int tt)
+std::vector<Ty> MDP<Ty,M>::infer_policies(unsigned int tt)
+{
+#ifdef LEARNING
+  refresh_A();
+#endif
+
+#ifdef FULL
+  unsigned int Np_t = _wt.size();
+#else
+  unsigned int Np_t = Np;
+#endif
+
+  /* path integrals of expected free energy, summed in double for
+     the single precision models and narrowed for the softmax */
+  std::vector<typename accumulator<Ty>::type> G(Np_t, 0.0);
+
+#ifdef POLICY_TRIE
+  /* path integral of expected free energy evaluated once
+     for each prefix shared by the policies */
+#ifdef FULL
+  unsigned int depth = T - tt;
+#else
+  unsigned int depth = policy_len;
+#endif
+
+  auto action = [&](unsigned int j, unsigned int k) -> int {
+#ifdef FULL
+    return _V(tt+j,_wt[k]);
+#else
+    return _V(j,k);
+#endif
+  };
+
+  PolicyTrie trie(Np_t, depth, action);
+
+  /* hidden state beliefs of the nodes of a level, stored
+     node after node and factor after factor */
+  std::vector<unsigned int> offset(Nf+1, 0);
+  for (unsigned int i = 0; i < Nf; i++)
+    offset[i+1] = offset[i] + Ns[i];
+  unsigned int Nx = offset[Nf];
+
+  std::vector<typename accumulator<Ty>::type> Gn(trie.get_nnodes(), 0.0);
+
+  std::vector<Ty> xl(Nx);
+  for (unsigned int i = 0; i < Nf; i++)
+    for (std::size_t j = 0; j != Ns[i]; ++j)
+      xl[offset[i]+j] = _X[i]->getValue(j,tt);
+
+  unsigned int prev_begin = 0;
+
+  for (unsigned int l = 0; l < depth; l++)
+  {
+    unsigned int begin = trie.level_begin(l);
+    unsigned int end = trie.level_end(l);
+
+    std::vector<Ty> xn((end-begin)*Nx);
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (unsigned int n = begin; n < end; n++)
+    {
+      int p = trie.get_parent(n);
+      int act = trie.get_action(n);
+
+      Ty *xp = (p < 0) ? &xl[0] : &xl[(p-prev_begin)*Nx];
+
+      Arena& a = scratch();
+      ArenaScope scope(a);
+
+      Ty **x = a.Alloc<Ty*>(Nf);
+      for (unsigned int i = 0; i < Nf; i++)
+      {
+        x[i] = &xn[(n-begin)*Nx+offset[i]];
+
+        /* hidden state belief expected according to the node prefix */
+        int act_u = _B[i].size() == 1 ? 0 : act;
+        _B[i][act_u]->Txv(xp+offset[i], x[i], a);
+      }
+#ifdef DEBUG
+      std::cout << "infer_policies: tt=" << tt << " l=" << l << " node=" << n << " parent=" << p << " action=" << act << std::endl;
+#endif
+
+      Gn[n] = (p < 0) ? 0.0 : Gn[p];
+
+      /* predicted entropy and divergence */
+      expected_free_energy(x, act, Gn[n]);
+    }
+#ifdef LEARNING
+    if (l == 0)
+      for (unsigned int k = 0; k < Np_t; k++)
+      {
+        unsigned int n = trie.get_node(k, 0);
+
+        for (unsigned int i = 0; i < Nf; i++)
+          for (std::size_t jj = 0; jj != Ns[i]; ++jj)
+#ifdef FULL
+            _xt[tt][_wt[k]][i].push_back(xn[(n-begin)*Nx+offset[i]+jj]);
+#else
+            _xt[tt][k][i].push_back(xn[(n-begin)*Nx+offset[i]+jj]);
+#endif
+      }
+#endif
+
+    xl.swap(xn);
+    prev_begin = begin;
+  }
+
+  for (unsigned int k = 0; k < Np_t; k++)
+  {
+    G[k] = Gn[trie.get_leaf(k)];
+#ifdef DEBUG
+    std::cout << "infer_policies: G[" << k << "]=" << G[k] << std::endl;
+#endif
+  }
+#elif defined BATCHED_ROLLOUT
+  /* path integral of expected free energy: the hidden state beliefs
+     of all the policies are rolled out together, for each factor as
+     an Ns[i] by Np_t block, through one sparse matrix-dense matrix
+     product for each action */
+#ifdef FULL
+  unsigned int j0 = tt;
+  unsigned int j1 = T;
+#else
+  unsigned int j0 = 0;
+  unsigned int j1 = policy_len;
+#endif
+
+  auto action = [&](unsigned int j, unsigned int k) -> int {
+#ifdef FULL
+    return _V(j,_wt[k]);
+#else
+    return _V(j,k);
+#endif
+  };
+
+  std::vector<std::vector<Ty>> xb(Nf);
+  for (unsigned int i = 0; i < Nf; i++)
+  {
+    xb[i].resize((std::size_t) Ns[i]*Np_t);
+
+    for (std::size_t j = 0; j != Ns[i]; ++j)
+      std::fill_n(&xb[i][j*Np_t], Np_t, _X[i]->getValue(j,tt));
+  }
+
+  for (unsigned int j = j0; j < j1; j++)
+  {
+    /* policies grouped by the action taken at step j */
+    std::vector<std::vector<unsigned int>> pu(Nu);
+    for (unsigned int k = 0; k < Np_t; k++)
+      pu[action(j,k)].push_back(k);
+
+    /* hidden state beliefs expected according to the policies */
+    for (unsigned int i = 0; i < Nf; i++)
+    {
+      if (_B[i].size() == 1)
+      {
+        std::vector<Ty> y(xb[i].size());
+        _B[i][0]->Txm(&xb[i][0], &y[0], Np_t);
+        xb[i].swap(y);
+        continue;
+      }
+
+      for (unsigned int u = 0; u < Nu; u++)
+      {
+        unsigned int n = pu[u].size();
+
+        if (n == 0)
+          continue;
+
+        std::vector<Ty> xu((std::size_t) Ns[i]*n), yu((std::size_t) Ns[i]*n);
+
+        for (std::size_t jj = 0; jj != Ns[i]; ++jj)
+          for (unsigned int c = 0; c < n; c++)
+            xu[jj*n+c] = xb[i][jj*Np_t+pu[u][c]];
+
+        _B[i][u]->Txm(&xu[0], &yu[0], n);
+
+        for (std::size_t jj = 0; jj != Ns[i]; ++jj)
+          for (unsigned int c = 0; c < n; c++)
+            xb[i][jj*Np_t+pu[u][c]] = yu[jj*n+c];
+      }
+    }
+
+    /* predicted entropy and divergence */
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (unsigned int k = 0; k < Np_t; k++)
+    {
+      Arena& a = scratch();
+      ArenaScope scope(a);
+
+      Ty **x = a.Alloc<Ty*>(Nf);
+
+      for (unsigned int i = 0; i < Nf; i++)
+      {
+        x[i] = a.Alloc<Ty>(Ns[i]);
+        for (std::size_t jj = 0; jj != Ns[i]; ++jj)
+          x[i][jj] = xb[i][jj*Np_t+k];
+#ifdef LEARNING
+        if (j == j0)
+#ifdef FULL
+          _xt[tt][_wt[k]][i].assign(x[i], x[i]+Ns[i]);
+#else
+          _xt[tt][k][i].assign(x[i], x[i]+Ns[i]);
+#endif
+#endif
+      }
+
+      expected_free_energy(x, action(j,k), G[k]);
+    }
+  }
+#ifdef DEBUG
+  for (unsigned int k = 0; k < Np_t; k++)
+    std::cout << "infer_policies: G[" << k << "]=" << G[k] << std::endl;
+#endif
+#else
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (unsigned int k = 0; k < Np_t; k++)
+  {
+    /* path integral of expected free energy */
+    Arena& a = scratch();
+    ArenaScope scope(a);
+
+    Ty **x = a.Alloc<Ty*>(Nf);
+    for (unsigned int i = 0; i < Nf; i++)
+      x[i] = a.Alloc<Ty>(Ns[i]);
+
+    for (unsigned int i = 0; i < Nf; i++)
+      for (std::size_t j = 0; j != Ns[i]; ++j)
+        x[i][j] = _X[i]->getValue(j,tt);
+
+#ifdef FULL
+    for (unsigned int j = tt; j < T; j++)
+#else
+    for (unsigned int j = 0; j < policy_len; j++)
+#endif
+    {
+#ifdef DEBUG
+      std::cout << "infer_policies: tt=" << tt << " k=" << k << " j=" << j << std::endl;
+#endif
+      /* transition probability from current state */
+      for (unsigned int i = 0; i < Nf; i++)
+      {
+        /* hidden state belief expected according to the k-th policy */
+#ifdef FULL
+        int act_u = _B[i].size() == 1 ? 0 : _V(j,_wt[k]);
+        _B[i][act_u]->Txv(x[i], x[i], a);
+#else
+        int act_u = _B[i].size() == 1 ? 0 : _V(j,k);
+        _B[i][act_u]->Txv(x[i], x[i], a);
+#endif
+#ifdef DEBUG
+        std::cout << "infer_policies: x[" << i << "] = ";
+        for (std::size_t jj = 0; jj != Ns[i]; ++jj)
+          std::cout << x[i][jj] << " ";
+        std::cout << std::endl;
+#endif
+#ifdef LEARNING
+#ifdef FULL
+        if (j == tt)
+#else
+        if (j == 0)
+#endif
+	{
+        for (std::size_t jj = 0; jj != Ns[i]; ++jj)
+#ifdef FULL
+	  _xt[tt][_wt[k]][i].push_back(x[i][jj]);
+#else
+	  _xt[tt][k][i].push_back(x[i][jj]);
+#endif
+        }
+#endif
+      }
+
+      /* predicted entropy and divergence */
+#ifdef FULL
+      expected_free_energy(x, _V(j,_wt[k]), G[k]);
+#else
+      expected_free_energy(x, _V(j,k), G[k]);
+#endif
+    }
+#ifdef DEBUG
+    std::cout << "infer_policies: G[" << k << "]=" << G[k] << std::endl;
+#endif
+  }
+#endif
+
+  std::vector<Ty> Gt(G.begin(), G.end());
+
+  policy_posterior(tt, Gt);
+
+  return Gt;
+}
+
+/* posterior beliefs about policies and precision given the expected
+   free energy G of the policies, and posterior expectations about
+   the actions of the steps ahead */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::policy_posterior(unsigned int tt, std::vector<Ty>& G)
+{
+#ifdef FULL
+  unsigned int Np_t = _wt.size();
+#else
+  unsigned int Np_t = Np;
+#endif
+
+  Ty b = alpha / gamma; /* expected rate parameter */
+
+  /* Variational iterations (assuming precise inference about past action) */
+  for (unsigned int it = 0; it < N; it++)
+  {
+    std::vector<Ty> __ut(Np_t, 0.0);
+
+    /* policy */
+    for (unsigned int i = 0; i < Np_t; i++)
+      __ut[i] = _W[tt]*G[i];
+
+    softmax<Ty>(__ut);
+
+    for (unsigned int i = 0; i < Np_t; i++)
+#ifdef FULL
+      _ut[tt][_wt[i]] = __ut[i];
+#else
+      _ut[tt][i] = __ut[i];
+#endif
+
+    /* precision */
+    b = lambda*b + (1 - lambda)*(beta - std::inner_product(std::begin(__ut), std::end(__ut), std::begin(G), 0.0));
+    _W[tt] = alpha / b;
+  }
+#ifdef DEBUG
+  std::cout << "infer_policies: _ut[" << tt << "] = ";
+  for (Ty val: _ut[tt]) {
+    std::cout << val << " ";
+  }
+  std::cout << std::endl;
+#endif
+
+  /* posterior expectations (control) */
+#ifdef FULL
+  for (unsigned int k = tt; k < T; k++)
+#else
+  unsigned int _T = (tt+policy_len < Tw) ? tt+policy_len : Tw;
+  for (unsigned int k = tt; k < _T; k++)
+#endif
+  {
+    for (unsigned int j = 0; j < Nu; j++)
+      _P[k][j] = 0.0;
+
+    /* one pass over the policies, each one adding to its action */
+    for (unsigned int i = 0; i < Np_t; i++)
+#ifdef FULL
+      _P[k][_V(k,_wt[i])] += _ut[tt][_wt[i]];
+#else
+      _P[k][_V(k-tt,i)] += _ut[tt][i];
+#endif
+  }
+#ifdef DEBUG
+  for (unsigned int k = 0; k < Tw; k++)
+  {
+    std::cout << "infer_policies: _P[" << k << "] = ";
+    for (Ty val: _P[k]) {
+      std::cout << val << " ";
+    }
+    std::cout << std::endl;
+  }
+#endif
+}
+
+/* tree search alternative to infer_policies: return the expected
+   free energy of each action for the current step */
+template <typename Ty, std::size_t M>
+std::vector<Ty> MDP<Ty,M>::infer_policies_tree(unsigned int tt)
+{
+#ifdef LEARNING
+  refresh_A();
+#endif
+
+#ifdef FULL
+  unsigned int depth = T - tt;
+#else
+  unsigned int depth = policy_len;
+#endif
+
+  std::vector<std::vector<Ty>> x(Nf);
+  for (unsigned int i = 0; i < Nf; i++)
+    for (std::size_t j = 0; j != Ns[i]; ++j)
+      x[i].push_back(_X[i]->getValue(j,tt));
+
+  std::vector<Ty> G;
+  forward_search(x, depth, G);
+  _Gx.clear();
+
+  Ty b = alpha / gamma; /* expected rate parameter */
+
+  /* Variational iterations (assuming precise inference about past action) */
+  for (unsigned int it = 0; it < N; it++)
+  {
+    std::vector<Ty> __pu(Nu, 0.0);
+
+    /* action */
+    for (unsigned int j = 0; j < Nu; j++)
+      __pu[j] = _W[tt]*G[j];
+
+    softmax<Ty>(__pu);
+
+    for (unsigned int j = 0; j < Nu; j++)
+      _P[tt][j] = __pu[j];
+
+    /* precision */
+    b = lambda*b + (1 - lambda)*(beta - std::inner_product(std::begin(__pu), std::end(__pu), std::begin(G), 0.0));
+    _W[tt] = alpha / b;
+  }
+#ifdef DEBUG
+  std::cout << "infer_policies_tree: _P[" << tt << "] = ";
+  for (Ty val: _P[tt]) {
+    std::cout << val << " ";
+  }
+  std::cout << std::endl;
+#endif
+
+  return G;
+}
+
+/* hidden state beliefs x as seen by the likelihood of modality g:
+   the beliefs of the factors g does not depend on are replaced by
+   a single 1, the belief marginalised over the broadcast dimension */
+template <typename Ty, std::size_t M>
+Ty **MDP<Ty,M>::modality_beliefs(unsigned int g, Ty **x, Arena& a)
+{
+  if (std::find(_Ad[g].begin(), _Ad[g].end(), false) == _Ad[g].end())
+    return x;
+
+  Ty **xg = a.Alloc<Ty*>(Nf);
+  Ty *one = a.Alloc<Ty>(1);
+  *one = 1.0;
+
+  for (unsigned int i = 0; i < Nf; i++)
+    xg[i] = _Ad[g][i] ? x[i] : one;
+
+  return xg;
+}
+
+/* accumulate in _G (in double for the single precision models)
+   the predicted entropy and divergence of the hidden state beliefs
+   x expected under action; if qo is given
+   the predicted outcomes of each modality are stored in it */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::expected_free_energy(Ty **x, int action,
+                                     typename accumulator<Ty>::type& _G,
+                                     std::vector<std::vector<Ty>> *qo)
+{
+  Arena& a = scratch();
+  ArenaScope scope(a);
+
+  /* joint hidden state beliefs, computed once for all the
+     modalities with the same state factor dimensions (xj[_Aj[g]]);
+     above HDOT_JOINT_LIMIT states the likelihood is contracted one
+     factor at a time instead. Sparse likelihoods use the joint
+     belief only if a dense one has already required it */
+  Ty **xj = a.Alloc<Ty*>(Ng);
+  Ty ***xg = a.Alloc<Ty**>(Ng);
+
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    xj[g] = NULL;
+    xg[g] = modality_beliefs(g, x, a);
+  }
+
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    int act_t = (_A[g].size() == 1) ? 0 : action;
+
+#ifdef SPARSE_LIKELIHOOD
+    if (_As[g][act_t])
+      continue;
+#endif
+    if (!xj[_Aj[g]] && _A[g][act_t]->get_tnc()/No[g] <= HDOT_JOINT_LIMIT)
+      xj[_Aj[g]] = _A[g][act_t]->cross(xg[g], a);
+  }
+
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    ArenaScope scope(a);
+
+    int act_t = (_A[g].size() == 1) ? 0 : action;
+    Ty H = 0.0;
+    Ty *_x = xj[_Aj[g]];
+
+    Ty *_qo;
+
+#ifdef SPARSE_LIKELIHOOD
+    if (_As[g][act_t])
+      _qo = _x ? _As[g][act_t]->HDot(_x, &H, a) :
+                 _As[g][act_t]->HDot(xg[g], &H, a);
+    else
+#endif
+#ifdef NO_PRECOMPUTE_ALOGA
+    _qo = _x ? _A[g][act_t]->HDot(_x, &H, a) :
+               _A[g][act_t]->HDot(xg[g], &H, a);
+#else
+    _qo = _x ? _A[g][act_t]->HDot(_x, *_AlogA[g][act_t], &H, a) :
+               _A[g][act_t]->HDot(xg[g], *_AlogA[g][act_t], &H, a);
+#endif
+#ifdef DEBUG
+    std::cout << "infer_policies: g=" << g << " H=" << H << " qo = ";
+    for (unsigned int kk = 0; kk < No[g]; kk++)
+      std::cout << _qo[kk] << " ";
+    std::cout << std::endl;
+#endif
+
+    _G += H;
+
+    for (unsigned int kk = 0; kk < No[g]; kk++)
+      if (_qo[kk] != 0.0)
+        _G += (_lnC[g]->getValue(kk) - log(_qo[kk]))*_qo[kk]; /* extrinsic value */
+#ifdef DEBUG
+    std::cout << "infer_policies: g=" << g << " G=" << _G << std::endl;
+#endif
+
+    if (qo)
+      (*qo)[g].assign(_qo, _qo+No[g]);
+  }
+}
+
+#ifdef BATCHED_AGENTS
+/* accumulate in _G[c] the predicted entropy and divergence of the
+   hidden state beliefs x[c] of the c-th agent of m expected under
+   action, as expected_free_energy does for one agent; the joint
+   beliefs of the agents are stacked in one matrix for each group
+   of modalities and the likelihood is contracted with all of them
+   at once. Sparse likelihoods and those above HDOT_JOINT_LIMIT
+   states are contracted agent after agent */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::expected_free_energy_batch(std::vector<MDP<Ty,M>*>& m,
+                                           Ty ***x, int action,
+                                           typename accumulator<Ty>::type *_G)
+{
+  MDP<Ty,M> *m0 = m[0];
+  std::size_t n = m.size();
+  unsigned int Ng = m0->Ng;
+
+  Arena& a = scratch();
+  ArenaScope scope(a);
+
+  /* joint hidden state beliefs of the agents, one column each */
+  Ty **xj = a.Alloc<Ty*>(Ng);
+  Ty ***xg = a.Alloc<Ty**>(Ng*n);
+
+  for (std::size_t c = 0; c < n; c++)
+    for (unsigned int g = 0; g < Ng; g++)
+      xg[g*n+c] = m0->modality_beliefs(g, x[c], a);
+
+  for (unsigned int g = 0; g < Ng; g++)
+    xj[g] = NULL;
+
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    int act_t = (m0->_A[g].size() == 1) ? 0 : action;
+    likelihood<Ty,M> *A = m0->_A[g][act_t];
+    std::size_t Nx = A->get_tnc()/m0->No[g];
+
+#ifdef SPARSE_LIKELIHOOD
+    if (m0->_As[g][act_t])
+      continue;
+#endif
+    if (xj[m0->_Aj[g]] || Nx > HDOT_JOINT_LIMIT)
+      continue;
+
+    Ty *X = a.Alloc<Ty>(Nx*n);
+
+    for (std::size_t c = 0; c < n; c++)
+    {
+      ArenaScope scope(a);
+
+      Ty *_x = A->cross(xg[g*n+c], a);
+
+      for (std::size_t r = 0; r < Nx; r++)
+        X[r*n+c] = _x[r];
+    }
+
+    xj[m0->_Aj[g]] = X;
+  }
+
+  for (unsigned int g = 0; g < Ng; g++)
+  {
+    ArenaScope scope(a);
+
+    int act_t = (m0->_A[g].size() == 1) ? 0 : action;
+    likelihood<Ty,M> *A = m0->_A[g][act_t];
+    unsigned int No = m0->No[g];
+    Ty *H = a.Alloc<Ty>(n);
+    Ty *_x = xj[m0->_Aj[g]];
+
+    /* predicted outcomes of the agents, one column each */
+    Ty *Q;
+
+#ifdef SPARSE_LIKELIHOOD
+    if (m0->_As[g][act_t])
+      _x = NULL;
+#endif
+    if (_x)
+#ifdef NO_PRECOMPUTE_ALOGA
+      Q = A->HDot(_x, n, NULL, H, a);
+#else
+      Q = A->HDot(_x, n, m0->_AlogA[g][act_t], H, a);
+#endif
+    else
+    {
+      Q = a.Alloc<Ty>(No*n);
+
+      for (std::size_t c = 0; c < n; c++)
+      {
+        ArenaScope scope(a);
+
+        Ty *_qo;
+
+#ifdef SPARSE_LIKELIHOOD
+        if (m0->_As[g][act_t])
+          _qo = m0->_As[g][act_t]->HDot(xg[g*n+c], &H[c], a);
+        else
+#endif
+#ifdef NO_PRECOMPUTE_ALOGA
+        _qo = A->HDot(xg[g*n+c], &H[c], a);
+#else
+        _qo = A->HDot(xg[g*n+c], *m0->_AlogA[g][act_t], &H[c], a);
+#endif
+
+        for (unsigned int kk = 0; kk < No; kk++)
+          Q[kk*n+c] = _qo[kk];
+      }
+    }
+
+    for (std::size_t c = 0; c < n; c++)
+    {
+      _G[c] += H[c];
+
+      for (unsigned int kk = 0; kk < No; kk++)
+        if (Q[kk*n+c] != 0.0)
+          _G[c] += (m0->_lnC[g]->getValue(kk) - log(Q[kk*n+c]))*Q[kk*n+c]; /* extrinsic value */
+    }
+  }
+}
+
+/* infer_policies of all the agents of m, at the time index tt[c] of
+   the c-th one: the agents share the model (clones of one MDP) and
+   the expected free energy of each policy is computed for all of
+   them at once (expected_free_energy_batch) by nt threads, each
+   policy by a single thread */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::infer_policies_batch(std::vector<MDP<Ty,M>*>& m,
+                                     const std::vector<unsigned int>& tt,
+                                     unsigned int nt)
+{
+#ifndef _OPENMP
+  (void) nt;
+#endif
+
+  if (m.empty())
+    return;
+
+  MDP<Ty,M> *m0 = m[0];
+  std::size_t n = m.size();
+  unsigned int Nf = m0->Nf;
+  unsigned int Np = m0->Np;
+
+  for (std::size_t c = 0; c < n; c++)
+    if (m[c]->_A != m0->_A || m[c]->_B != m0->_B ||
+        m[c]->Np != Np || m[c]->policy_len != m0->policy_len)
+    {
+      std::cerr << "infer_policies_batch: the agents must share the model" << std::endl;
+      exit(-1);
+    }
+
+#ifdef LEARNING
+  for (std::size_t c = 0; c < n; c++)
+    m[c]->refresh_A();
+#endif
+
+  /* expected free energy of the k-th policy of the agents
+     at Gb[k*n], ..., Gb[k*n+n-1] */
+  std::vector<typename accumulator<Ty>::type> Gb((std::size_t) Np*n, 0.0);
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(nt)
+#endif
+  for (unsigned int k = 0; k < Np; k++)
+  {
+    /* path integral of expected free energy */
+    Arena& a = scratch();
+    ArenaScope scope(a);
+
+    Ty ***x = a.Alloc<Ty**>(n);
+    for (std::size_t c = 0; c < n; c++)
+    {
+      x[c] = a.Alloc<Ty*>(Nf);
+
+      for (unsigned int i = 0; i < Nf; i++)
+      {
+        x[c][i] = a.Alloc<Ty>(m0->Ns[i]);
+
+        for (std::size_t j = 0; j != m0->Ns[i]; ++j)
+          x[c][i][j] = m[c]->_X[i]->getValue(j,tt[c]);
+      }
+    }
+
+    for (unsigned int j = 0; j < m0->policy_len; j++)
+    {
+      /* hidden state beliefs expected according to the k-th policy */
+      for (std::size_t c = 0; c < n; c++)
+        for (unsigned int i = 0; i < Nf; i++)
+        {
+          int act_u = m0->_B[i].size() == 1 ? 0 : m0->_V(j,k);
+          m0->_B[i][act_u]->Txv(x[c][i], x[c][i], a);
+#ifdef LEARNING
+          if (j == 0)
+            m[c]->_xt[tt[c]][k][i].assign(x[c][i], x[c][i]+m0->Ns[i]);
+#endif
+        }
+
+      /* predicted entropy and divergence */
+      expected_free_energy_batch(m, x, m0->_V(j,k), &Gb[(std::size_t) k*n]);
+    }
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(nt)
+#endif
+  for (std::size_t c = 0; c < n; c++)
+  {
+    std::vector<Ty> G(Np);
+
+    for (unsigned int k = 0; k < Np; k++)
+      G[k] = Gb[(std::size_t) k*n+c];
+
+    m[c]->policy_posterior(tt[c], G);
+  }
+}
+
+/* active_inference of all the agents of m in lockstep, with the
+   policies of each time step inferred for all of them at once by
+   infer_policies_batch; each agent runs the steps of the member
+   function active_inference (not of an override) and leaves the
+   batch when its episode_end returns true */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::active_inference_batch(std::vector<MDP<Ty,M>*>& m,
+                                       unsigned int nt)
 {
-#ifdef FULL
-  unsigned int Np_t = _wt.size();
-#else
-  unsigned int Np_t = Np;
-#endif
+  if (m.empty())
+    return;
+
+  unsigned int T = m[0]->T;
+  unsigned int Tw = m[0]->Tw;
+
+  /* the histories hold the last Tw time steps (T without macro
+     STREAMING): tt is the time index of the time step s */
+  unsigned int tt = 0;
+
+  for (std::size_t c = 0; c < m.size(); c++)
+  {
+    if (m[c]->_online)
+    {
+      std::cerr << "active_inference: the agent has already taken online steps" << std::endl;
+      exit(-1);
+    }
+
+    m[c]->_step = 0;
+    m[c]->_steps = 0;
+  }
 
-  std::vector<Ty> G(Np_t, 0.0); 
+  /* agents whose episode has not ended */
+  std::vector<MDP<Ty,M>*> live(m);
+
+  for (unsigned int s = 0; s < T && !live.empty(); s++)
+  {
+    std::size_t n = live.size();
 
 #ifdef _OPENMP
-  #pragma omp parallel for
+    #pragma omp parallel for schedule(dynamic) num_threads(nt)
 #endif
-  for (unsigned int k = 0; k < Np_t; k++)
-  {
-    /* path integral of expected free energy */
-    Ty **x = new Ty*[Nf];
-    for (unsigned int i = 0; i < Nf; i++)
-      x[i] = new Ty[Ns[i]];
+    for (std::size_t c = 0; c < n; c++)
+      live[c]->infer_states(tt);
 
-    for (unsigned int i = 0; i < Nf; i++)
-      for (std::size_t j = 0; j != Ns[i]; ++j)
-        x[i][j] = _X[i]->getValue(j,tt);
+    infer_policies_batch(live, std::vector<unsigned int>(n, tt), nt);
 
-#ifdef FULL
-    for (unsigned int j = tt; j < T; j++)
-#else
-    for (unsigned int j = 0; j < policy_len; j++)
+    /* the window is full: the oldest time step leaves it */
+    bool full = (tt == Tw-1) && (s < T-1);
+
+    std::vector<char> end(n, 0);
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(nt)
 #endif
+    for (std::size_t c = 0; c < n; c++)
     {
-#ifdef DEBUG
-      std::cout << "infer_policies: tt=" << tt << " k=" << k << " j=" << j << std::endl;
-#endif
-      /* transition probability from current state */
-      for (unsigned int i = 0; i < Nf; i++)
-      {
-        /* hidden state belief expected according to the k-th policy */
-#ifdef FULL
-        int act_u = _B[i].size() == 1 ? 0 : _V[j][_wt[k]];
-        _B[i][act_u]->Txv(x[i], x[i]);
-#else
-        int act_u = _B[i].size() == 1 ? 0 : _V[j][k];
-        _B[i][act_u]->Txv(x[i], x[i]);
-#endif
-#ifdef DEBUG
-        std::cout << "infer_policies: x[" << i << "] = ";
-        for (std::size_t jj = 0; jj != Ns[i]; ++jj)
-          std::cout << x[i][jj] << " ";
-        std::cout << std::endl;
-#endif
-#ifdef LEARNING
-#ifdef FULL
-        if (j == tt)
-#else
-        if (j == 0)
-#endif
-	{
-        for (std::size_t jj = 0; jj != Ns[i]; ++jj)
-#ifdef FULL
-	  _xt[tt][_wt[k]][i].push_back(x[i][jj]);
-#else
-	  _xt[tt][k][i].push_back(x[i][jj]);
-#endif
-        }
-#endif
-      }
+      int a = live[c]->sample_action(tt);
 
-      /* predicted entropy and divergence */
-      for (unsigned int g = 0; g < Ng; g++)
+      int next = -1;
+
+      if (s < T-1)
       {
-#ifdef FULL
-        int act_t = (_A[g].size() == 1) ? 0 : _V[j][_wt[k]];
-#else
-        int act_t = (_A[g].size() == 1) ? 0 : _V[j][k];
-#endif
-        Ty H = 0.0;
+        if (full)
+          live[c]->shift(Tw, s+1-Tw);
 
-#ifdef NO_PRECOMPUTE_ALOGA
-        auto qo = _A[g][act_t]->HDot(x, &H);
-#else
-        auto qo = _A[g][act_t]->HDot(x, *_AlogA[g][act_t], &H);
-#endif
-#ifdef DEBUG
-        std::cout << "infer_policies: g=" << g << " H=" << H << " qo = ";
-        for (unsigned int kk = 0; kk < No[g]; kk++)
-          std::cout << qo[kk] << " ";
-        std::cout << std::endl;
-#endif
+        next = full ? tt : tt+1;
 
-        G[k] += H;
+        live[c]->sample_state(next, a);
+        live[c]->sample_observation(next, a);
+      }
 
-        for (unsigned int kk = 0; kk < No[g]; kk++)
-          if (qo[kk] != 0.0)
-            G[k] += (_lnC[g]->getValue(kk) - log(qo[kk]))*qo[kk]; /* extrinsic value */
-#ifdef DEBUG
-        std::cout << "infer_policies: g=" << g << " G=" << G[k] << std::endl;
-#endif
+      live[c]->_step++;
+      live[c]->_steps = s+1;
 
-        delete [] qo;
-      }
+      end[c] = live[c]->episode_end(a, next);
     }
-#ifdef DEBUG
-    std::cout << "infer_policies: G[" << k << "]=" << G[k] << std::endl;
+
+    /* the agents whose episode has ended leave the batch */
+    std::size_t k = 0;
+    for (std::size_t c = 0; c < n; c++)
+      if (!end[c])
+        live[k++] = live[c];
+    live.resize(k);
+
+    if (!full)
+      tt++;
+  }
+}
+
+/* online step of all the agents of m: obs[c] are the outcomes
+   observed by the c-th agent, whose action is returned in u[c];
+   the policies are inferred for all the agents at once */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::step_batch(std::vector<MDP<Ty,M>*>& m,
+                           const std::vector<std::vector<unsigned int>>& obs,
+                           std::vector<int>& u, unsigned int nt)
+{
+  std::size_t n = m.size();
+  std::vector<unsigned int> tt(n);
+
+  u.resize(n);
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) num_threads(nt)
 #endif
+  for (std::size_t c = 0; c < n; c++)
+    tt[c] = m[c]->observe(obs[c]);
 
-    for (unsigned int i = 0; i < Nf; i++)
-      delete [] x[i];
-    delete [] x;
+  infer_policies_batch(m, tt, nt);
+
+  for (std::size_t c = 0; c < n; c++)
+  {
+    m[c]->_step++;
+    m[c]->_steps++;
+
+    u[c] = m[c]->sample_action(tt[c]);
   }
+}
+#endif
 
-  Ty b = alpha / gamma; /* expected rate parameter */
+/* sophisticated inference: store in G the expected free energy of
+   each action from the hidden state beliefs x, looking ahead depth
+   steps over the action-observation branches; the branches of the
+   actions and of the outcomes outside the Occam windows are pruned
+   and beliefs already visited at the same depth are not expanded
+   again */
+template <typename Ty, std::size_t M>
+void MDP<Ty,M>::forward_search(std::vector<std::vector<Ty>>& x,
+                               unsigned int depth, std::vector<Ty>& G)
+{
+  /* beliefs (quantised) already visited at the same depth */
+  std::vector<long long> key(1, depth);
+  for (unsigned int i = 0; i < Nf; i++)
+    for (std::size_t j = 0; j != Ns[i]; ++j)
+      key.push_back(llround(x[i][j]/maxError));
 
-  /* Variational iterations (assuming precise inference about past action) */
-  for (unsigned int it = 0; it < N; it++)
+  bool visited = false;
+#ifdef _OPENMP
+  #pragma omp critical (forward_search)
+#endif
   {
-    std::vector<Ty> __ut(Np_t, 0.0);
+    auto it = _Gx.find(key);
+    if (it != _Gx.end())
+    {
+      G = it->second;
+      visited = true;
+    }
+  }
 
-    /* policy */
-    for (unsigned int i = 0; i < Np_t; i++)
-      __ut[i] = _W[tt]*G[i];
+  if (visited)
+    return;
 
-    softmax<Ty>(__ut);
+  /* expected free energy of each action, summed in double for the
+     single precision models */
+  std::vector<typename accumulator<Ty>::type> Gu(Nu, 0.0);
 
-    for (unsigned int i = 0; i < Np_t; i++)
-#ifdef FULL
-      _ut[tt][_wt[i]] = __ut[i];
-#else
-      _ut[tt][i] = __ut[i];
+  /* hidden state beliefs and outcomes expected under each action */
+  std::vector<std::vector<std::vector<Ty>>> xu(Nu, std::vector<std::vector<Ty>>(Nf));
+  std::vector<std::vector<std::vector<Ty>>> qu(Nu, std::vector<std::vector<Ty>>(Ng));
+
+#ifdef _OPENMP
+  #pragma omp parallel for
 #endif
+  for (unsigned int u = 0; u < Nu; u++)
+  {
+    std::vector<Ty*> _x(Nf);
 
-    /* precision */
-    b = lambda*b + (1 - lambda)*(beta - std::inner_product(std::begin(__ut), std::end(__ut), std::begin(G), 0.0));
-    _W[tt] = alpha / b;
+    for (unsigned int i = 0; i < Nf; i++)
+    {
+      xu[u][i].resize(Ns[i]);
+
+      int act_u = _B[i].size() == 1 ? 0 : u;
+      _B[i][act_u]->Txv(&x[i][0], &xu[u][i][0]);
+
+      _x[i] = &xu[u][i][0];
+    }
+
+    expected_free_energy(_x.data(), u, Gu[u], &qu[u]);
   }
 #ifdef DEBUG
-  std::cout << "infer_policies: _ut[" << tt << "] = ";
-  for (Ty val: _ut[tt]) {
+  std::cout << "forward_search: depth=" << depth << " G = ";
+  for (auto val: Gu)
     std::cout << val << " ";
-  }
   std::cout << std::endl;
 #endif
 
-  /* posterior expectations (control) */
-#ifdef FULL
-  for (unsigned int k = tt; k < T; k++)
-#else
-  unsigned int _T = (tt+policy_len < T) ? tt+policy_len : T;
-  for (unsigned int k = tt; k < _T; k++)
+  if (depth > 1)
+  {
+    /* Occam window over actions */
+    std::vector<Ty> pu(Gu.begin(), Gu.end());
+    softmax<Ty>(pu);
+    Ty pu_max = *std::max_element(pu.begin(), pu.end());
+    typename accumulator<Ty>::type G_max = *std::max_element(Gu.begin(), Gu.end());
+
+#ifdef _OPENMP
+    #pragma omp parallel for
 #endif
-    for (unsigned int j = 0; j < Nu; j++)
+    for (unsigned int u = 0; u < Nu; u++)
     {
-      _P[k][j] = 0.0;
+      if (pu[u] <= pu_max*occam_u)
+      {
+        Gu[u] = G_max - occam_G;
+        continue;
+      }
 
-      for (unsigned int i = 0; i < Np_t; i++)
-#ifdef FULL
-        if (_V[k][_wt[i]] == (int) j)
-          _P[k][j] += _ut[tt][_wt[i]];
-#else
-        if (_V[k-tt][i] == (int) j)
-          _P[k][j] += _ut[tt][i];
+      /* joint outcomes (product of the outcomes of each modality)
+         within the Occam window */
+      std::vector<std::pair<Ty,std::vector<int>>> O(1, std::make_pair(1.0, std::vector<int>()));
+
+      for (unsigned int g = 0; g < Ng; g++)
+      {
+        std::vector<std::pair<Ty,std::vector<int>>> _O;
+
+        for (auto& o: O)
+          for (unsigned int kk = 0; kk < No[g]; kk++)
+            if (o.first*qu[u][g][kk] > occam_o)
+            {
+              _O.push_back(o);
+              _O.back().first *= qu[u][g][kk];
+              _O.back().second.push_back(kk);
+            }
+
+        O.swap(_O);
+      }
+
+      std::vector<Ty*> _x(Nf);
+      for (unsigned int i = 0; i < Nf; i++)
+        _x[i] = &xu[u][i][0];
+
+      Arena& a = scratch();
+      ArenaScope scope(a);
+
+      Ty ***xg = a.Alloc<Ty**>(Ng);
+      for (unsigned int g = 0; g < Ng; g++)
+        xg[g] = modality_beliefs(g, _x.data(), a);
+
+      for (auto& o: O)
+      {
+        /* posterior beliefs after the outcome o */
+        std::vector<std::vector<Ty>> xo(Nf);
+
+        for (unsigned int i = 0; i < Nf; i++)
+        {
+          xo[i].resize(Ns[i]);
+          for (std::size_t j = 0; j != Ns[i]; ++j)
+            xo[i][j] = _log(xu[u][i][j]);
+
+          std::vector<Ty> v(Ns[i]);
+
+          for (unsigned int g = 0; g < Ng; g++)
+          {
+            int act_t = (_A[g].size() == 1) ? 0 : u;
+#ifdef SPARSE_LIKELIHOOD
+            if (_As[g][act_t])
+              _As[g][act_t]->Marginal(o.second[g], xg[g], i, &v[0]);
+            else
 #endif
+            _A[g][act_t]->Marginal(o.second[g], xg[g], i, &v[0]);
+
+            /* the outcomes of g may not depend on the factor i */
+            for (std::size_t j = 0; j != Ns[i]; ++j)
+              xo[i][j] += _log(v[_Ad[g][i] ? j : 0]);
+          }
+
+          softmax<Ty>(xo[i]);
+        }
+
+        /* expected free energy of the next action */
+        std::vector<Ty> Go;
+        forward_search(xo, depth-1, Go);
+
+        std::vector<Ty> po(Go);
+        softmax<Ty>(po);
+
+        Gu[u] += o.first*std::inner_product(po.begin(), po.end(), Go.begin(), 0.0);
+      }
     }
-#ifdef DEBUG
-  for (unsigned int k = 0; k < T; k++)
-  {
-    std::cout << "infer_policies: _P[" << k << "] = ";
-    for (Ty val: _P[k]) {
-      std::cout << val << " ";
-    }
-    std::cout << std::endl;
   }
+
+#ifdef _OPENMP
+  #pragma omp critical (forward_search)
 #endif
+  G.assign(Gu.begin(), Gu.end());
 
-  return G;
+  _Gx[key] = G;
 }
 
 template <typename Ty, std::size_t M>
@@ -896,6 +2450,10 @@ void MDP<Ty,M>::sample_state(unsigned int tt, int action)
 template <typename Ty, std::size_t M>
 void MDP<Ty,M>::sample_observation(unsigned int tt, int action)
 {
+#ifdef LEARNING
+  refresh_A();
+#endif
+
   for (unsigned int g = 0; g < Ng; g++) {
     std::vector<Ty> po(No[g], 0.0);
 
@@ -904,6 +2462,11 @@ void MDP<Ty,M>::sample_observation(unsigned int tt, int action)
     _AA[g][act_t]->find(_st[tt], po);
 #else
     int act_t = (_A[g].size() == 1) ? 0 : action;
+#ifdef SPARSE_LIKELIHOOD
+    if (_As[g][act_t])
+      _As[g][act_t]->find(_st[tt], po);
+    else
+#endif
     _A[g][act_t]->find(_st[tt], po);
 #endif
 #ifdef DEBUG
@@ -923,36 +2486,92 @@ void MDP<Ty,M>::sample_observation(unsigned int tt, int action)
   }
 }
 
+/* called by active_inference after the action a of each step is
+   selected and the next state and outcome sampled, with a and the
+   time index t of the next state (-1 after the last step): the
+   episode ends when it returns true */
+template <typename Ty, std::size_t M>
+bool MDP<Ty,M>::episode_end(int a, int t)
+{
+  (void) a;
+  (void) t;
+
+  return false;
+}
+
+/* time steps of the episode, until the temporal horizon or until
+   episode_end returns true. With macro STREAMING the histories hold
+   the last Tw time steps and slide once they are full */
 template <typename Ty, std::size_t M>
 void MDP<Ty,M>::active_inference()
 {
+#ifndef FULL
+  /* the histories of the online steps have replaced the ones of the
+     episode, and the true states are no longer used */
+  if (_online)
+  {
+    std::cerr << "active_inference: the agent has already taken online steps" << std::endl;
+    exit(-1);
+  }
+#endif
+
+  /* time index of the time step s */
   unsigned int tt = 0;
 
-  while (tt < T)
+  _steps = 0;
+
+  for (unsigned int s = 0; s < T; s++)
   {
+#ifdef STREAMING
+    _step = s;
+#endif
 #ifdef PRINT
-    std::cout << "active_inference: tt=" << tt << std::endl;
+    std::cout << "active_inference: tt=" << s << std::endl;
 #endif
 
     infer_states(tt);
 
     /* value of policies (G) */
+#ifdef TREE_SEARCH
+    std::vector<Ty> G = infer_policies_tree(tt);
+#else
     std::vector<Ty> G = infer_policies(tt);
+#endif
 
     /* next action (the action that minimises expected free energy) */
     int a = sample_action(tt);
 
+    int next = -1;
+
     /* sampling of next state (outcome) */
-    if (tt < T-1)
+    if (s < T-1)
     {
+#ifdef STREAMING
+      if (tt == Tw-1)
+      {
+        shift(Tw, s+1-Tw);
+        tt--;
+      }
+#endif
+
       /* next sampled state */
       sample_state(tt+1, a);
 
       /* next observed state */
       sample_observation(tt+1, a);
+
+      next = tt+1;
     }
 
     tt += 1;
+    _steps = s+1;
+
+#ifdef STREAMING
+    _step = s+1;
+#endif
+
+    if (episode_end(a, next))
+      break;
   }
 }
 
@@ -963,23 +2582,26 @@ std::vector<std::vector<likelihood<Ty,M>*>>& MDP<Ty,M>::update_A(
                 std::vector<std::vector<likelihood<Ty,M>*>>& _a,
                 Ty eta, unsigned int tt)
 {
-  for (unsigned int g = 0; g < Ng; g++) {
-    likelihood<Ty,M> *_da = new likelihood<Ty,M>(_a[g][0]->GetIndexArray());
-    _da->cross(_O[g]->StateFind(tt), tt, _X);
+  /* _a may be the likelihoods of the model itself */
+  for (unsigned int g = 0; g < Ng; g++)
+    for (unsigned int j = 0; j < _a[g].size() && j < _A[g].size(); j++)
+      if (_a[g][j] == _A[g][j])
+      {
+        if (_shared || _compiled)
+        {
+          std::cerr << "update_A: the likelihoods of a shared or compiled model are read only" << std::endl;
+          exit(-1);
+        }
 
+        _Astale[g] = true;
+      }
+
+  for (unsigned int g = 0; g < Ng; g++) {
     unsigned int act_Nu = _a[g].size() == 1 ? 1 : Nu;
 
+    /* Dirichlet counts of the observed outcome, in place */
     for (unsigned int j = 0; j < act_Nu; j++)
-    {
-      likelihood<Ty,M> *_dau = new likelihood<Ty,M>(_a[g][0]->GetIndexArray());
-      _dau->multiplies(*_da, *_a[g][j]);
-
-      _a[g][j]->sum(*_dau, eta);
-
-      delete _dau;
-    }
-
-    delete _da;
+      _a[g][j]->add_cross(_O[g]->StateFind(tt), tt, _X, eta);
 
 #ifdef DEBUG
     for (unsigned int j = 0; j < _A[g].size(); j++)
@@ -1002,42 +2624,109 @@ std::vector<std::vector<Transitions<Ty>*>>& MDP<Ty,M>::update_B(
                 std::vector<std::vector<Transitions<Ty>*>>& _b,
                 Ty eta, unsigned int tt)
 {
+#ifndef TREE_SEARCH
 #ifdef FULL
   unsigned int Np_t = _wt.size();
 #else
   unsigned int Np_t = Np;
 #endif
+#endif
+
+  /* _b may be the transitions of the model itself, whose logarithms
+     are then out of date */
+  bool own = false;
+  for (unsigned int i = 0; i < Nf; i++)
+    for (unsigned int j = 0; j < _b[i].size() && j < _B[i].size(); j++)
+      if (_b[i][j] == _B[i][j])
+      {
+        if (_shared || _compiled)
+        {
+          std::cerr << "update_B: the transitions of a shared or compiled model are read only" << std::endl;
+          exit(-1);
+        }
+
+        own = true;
+      }
+
+  if (own)
+    clear_lnB();
 
   for (unsigned int i = 0; i < Nf; i++)
   {
+#ifdef TREE_SEARCH
+    /* no policies are built: the counts are the ones of the action
+       taken at tt-1, between the posterior beliefs about the hidden
+       states at tt-1 and tt */
+    int v = _b[i].size() == 1 ? 0 : U[tt-1];
+
+    if (v >= 0)
+      _b[i][v]->add_outer(eta, _X[i]->getArray(tt), _X[i]->getArray(tt-1));
+#else
+#ifdef GROUP_UPDATE_B
+    /* policies with the same action and the same beliefs at tt-1
+       and tt (e.g. the ones sharing the prefix of actions up to tt)
+       contribute the same outer product: their weights are summed
+       and one update is made for each group, in order of first
+       appearance */
+#ifdef FULL
+    std::map<std::pair<int, std::vector<Ty>>, unsigned int> group;
+#else
+    /* the beliefs stored for a policy are the ones predicted by its
+       first action, from beliefs common to all the policies: the
+       groups are indexed by the pair of actions, in a table of Nu x
+       Nu entries (-1 for no group yet) */
+    std::vector<int> group((std::size_t) Nu*Nu, -1);
+#endif
+    std::vector<int> gv, gp; /* action and policy of each group */
+    std::vector<Ty> gu; /* sum of the weights of each group */
+#endif
+
     for (unsigned int k = 0; k < Np_t; k++)
     {
 #ifdef FULL
-      int v = _b[i].size() == 1 ? 0 : _V[tt-1][_wt[k]];
+      int v = _b[i].size() == 1 ? 0 : _V(tt-1,_wt[k]);
       int p = _wt[k];
       Ty _ut_tk = _ut[tt][_wt[k]];
 #else
-      int v = _b[i].size() == 1 ? 0 : _V[(tt-1)%policy_len][k];
+      int v = _b[i].size() == 1 ? 0 : _V((tt-1)%policy_len,k);
       int p = k;
       Ty _ut_tk = _ut[tt][k];
 #endif
  
-      std::vector<std::vector<Ty>> db(Ns[i], std::vector<Ty>(Ns[i], 0));
-
-      for (std::size_t jj = 0; jj != Ns[i]; ++jj)
-        for (std::size_t kk = 0; kk != Ns[i]; ++kk)
-          db[jj][kk] = _ut_tk * _xt[tt][p][i][jj] * _xt[tt-1][p][i][kk];
-
-      db = _b[i][v]->multiplies(db);
-
-      std::vector<std::vector<Ty>> _b_iu(Ns[i], std::vector<Ty>(Ns[i], 0));
-      _b[i][v]->add(db, _b_iu, eta);
+#ifdef GROUP_UPDATE_B
+#ifdef FULL
+      std::vector<Ty> key(_xt[tt][p][i]);
+      key.insert(key.end(), _xt[tt-1][p][i].begin(), _xt[tt-1][p][i].end());
 
-      Transitions<Ty> *__b_iu = new Transitions<FLOAT_TYPE>(_b_iu);
-      delete _b[i][v];
-      _b[i][v] = __b_iu;
+      auto it = group.insert(std::make_pair(std::make_pair(v, key), gp.size()));
+      bool first = it.second;
+      unsigned int gk = it.first->second;
+#else
+      int &gk = group[(std::size_t) v*Nu + _V(0,k)];
+      bool first = (gk < 0);
+      if (first)
+        gk = gp.size();
+#endif
+      if (first)
+      {
+        gv.push_back(v);
+        gp.push_back(p);
+        gu.push_back(_ut_tk);
+      }
+      else
+        gu[gk] += _ut_tk;
+#else
+      /* Dirichlet counts of the stored elements, in place */
+      _b[i][v]->add_outer(eta*_ut_tk, &_xt[tt][p][i][0], &_xt[tt-1][p][i][0]);
+#endif
     }
 
+#ifdef GROUP_UPDATE_B
+    for (unsigned int g = 0; g < gp.size(); g++)
+      _b[i][gv[g]]->add_outer(eta*gu[g], &_xt[tt][gp[g]][i][0], &_xt[tt-1][gp[g]][i][0]);
+#endif
+#endif
+
 #ifdef DEBUG
     for (unsigned int j = 0; j < _b[i].size(); j++)
     {
@@ -0,0 +1,140 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef POLICY_TRIE_HPP
+#define POLICY_TRIE_HPP
+#include <iostream>
+#include <vector>
+#include <map>
+#include <utility>
+
+/* prefix trie of a set of Np policies of length depth:
+   policies sharing the same sequence of actions up to
+   a given step share the same node, so that everything
+   depending only on that prefix (belief rollout and
+   expected free energy) is computed once;
+   nodes are stored level by level, the nodes at level l
+   (step l of the policies) are level_begin(l),...,level_end(l)-1
+   and the root (current beliefs) is not stored */
+class PolicyTrie {
+private:
+  unsigned int Nl; /* number of levels */
+  std::vector<int> parent; /* parent node, -1 for the root */
+  std::vector<int> act; /* action taken to reach the node */
+  std::vector<unsigned int> level_ptr;
+  std::vector<unsigned int> leaf; /* last node of each policy */
+
+public:
+  /* action(j,k) returns the action of the k-th policy at step j */
+  template <typename F>
+  PolicyTrie(unsigned int Np, unsigned int depth, F action)
+  {
+    Nl = depth;
+
+    std::vector<int> cur(Np, -1);
+
+    level_ptr.push_back(0);
+
+    for (unsigned int j = 0; j < Nl; j++)
+    {
+      std::map<std::pair<int,int>, unsigned int> children;
+
+      for (unsigned int k = 0; k < Np; k++)
+      {
+        std::pair<int,int> key(cur[k], action(j,k));
+
+        auto it = children.find(key);
+
+        if (it == children.end())
+        {
+          unsigned int node = parent.size();
+
+          parent.push_back(cur[k]);
+          act.push_back(key.second);
+
+          it = children.insert(std::make_pair(key, node)).first;
+        }
+
+        cur[k] = it->second;
+      }
+
+      level_ptr.push_back(parent.size());
+    }
+
+    leaf.assign(cur.begin(), cur.end());
+  }
+
+  unsigned int get_nlevels()
+  {
+    return Nl;
+  }
+
+  unsigned int get_nnodes()
+  {
+    return parent.size();
+  }
+
+  unsigned int level_begin(unsigned int l)
+  {
+    return level_ptr[l];
+  }
+
+  unsigned int level_end(unsigned int l)
+  {
+    return level_ptr[l+1];
+  }
+
+  int get_parent(unsigned int n)
+  {
+    return parent[n];
+  }
+
+  int get_action(unsigned int n)
+  {
+    return act[n];
+  }
+
+  /* node reached by the k-th policy at level l */
+  unsigned int get_node(unsigned int k, unsigned int l)
+  {
+    unsigned int n = leaf[k];
+
+    for (unsigned int j = Nl-1; j > l; j--)
+      n = parent[n];
+
+    return n;
+  }
+
+  /* last node of the k-th policy */
+  unsigned int get_leaf(unsigned int k)
+  {
+    return leaf[k];
+  }
+};
+#endif
@@ -75,6 +75,17 @@ public:
       value[i] = 0.0;
   }
 
+  /* sum of this object and the one given as a parameter
+     multiplied by a factor */
+  void sum(const Priors<T>& p, T e)
+  {
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for(unsigned int i = 0; i < this->Ns; i++)
+      value[i] += p.value[i]*e;
+  }
+
   /* logarithmic transformation (after normalisation) */
   void NormLog()
   {
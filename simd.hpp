@@ -0,0 +1,594 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SIMD_HPP
+#define SIMD_HPP
+#include <cstddef>
+#include <cmath>
+#if !defined NO_SIMD && defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* explicit SIMD kernels for the reductions of the models: the
+   single precision dot products widen their operands and accumulate
+   in double; the instruction set (SSE2, AVX2 or AVX-512) is selected
+   once, at the first call, from the features of the CPU, so that a
+   single binary uses the widest vectors available on each host;
+   with NO_SIMD, or on other architectures, the scalar kernels are
+   used */
+namespace simd
+{
+  /* scalar kernels */
+  inline double dot_scalar(std::size_t n, const double *a, const double *x)
+  {
+    double s = 0.0;
+
+    for (std::size_t i = 0; i < n; i++)
+      s += a[i] * x[i];
+
+    return s;
+  }
+
+  inline double dot2_scalar(std::size_t n, const double *a, const double *b,
+                            const double *x, double *h)
+  {
+    double s = 0.0, t = 0.0;
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+      s += a[i] * x[i];
+      t += b[i] * x[i];
+    }
+
+    *h = t;
+
+    return s;
+  }
+
+  inline double dotf_scalar(std::size_t n, const float *a, const float *x)
+  {
+    double s = 0.0;
+
+    for (std::size_t i = 0; i < n; i++)
+      s += (double) a[i] * x[i];
+
+    return s;
+  }
+
+  inline double dot2f_scalar(std::size_t n, const float *a, const float *b,
+                             const float *x, double *h)
+  {
+    double s = 0.0, t = 0.0;
+
+    for (std::size_t i = 0; i < n; i++)
+    {
+      s += (double) a[i] * x[i];
+      t += (double) b[i] * x[i];
+    }
+
+    *h = t;
+
+    return s;
+  }
+
+  inline double max_scalar(std::size_t n, const double *x)
+  {
+    double m = -INFINITY;
+
+    for (std::size_t i = 0; i < n; i++)
+      if (x[i] > m)
+        m = x[i];
+
+    return m;
+  }
+
+  inline void scale_scalar(std::size_t n, double alpha, const double *x,
+                           double *y)
+  {
+    for (std::size_t i = 0; i < n; i++)
+      y[i] = alpha * x[i];
+  }
+
+  inline void axpy_scalar(std::size_t n, double alpha, const double *x,
+                          double *y)
+  {
+    for (std::size_t i = 0; i < n; i++)
+      y[i] = y[i] + alpha * x[i];
+  }
+
+#ifdef SIMD_X86
+  /* SSE2 kernels */
+  __attribute__((target("sse2")))
+  inline double dot_sse2(std::size_t n, const double *a, const double *x)
+  {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+      s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a+i), _mm_loadu_pd(x+i)));
+      s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a+i+2), _mm_loadu_pd(x+i+2)));
+    }
+
+    double r[2];
+    _mm_storeu_pd(r, _mm_add_pd(s0, s1));
+
+    return r[0] + r[1] + dot_scalar(n-i, a+i, x+i);
+  }
+
+  __attribute__((target("sse2")))
+  inline double dot2_sse2(std::size_t n, const double *a, const double *b,
+                          const double *x, double *h)
+  {
+    __m128d s = _mm_setzero_pd(), t = _mm_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+    {
+      __m128d xv = _mm_loadu_pd(x+i);
+      s = _mm_add_pd(s, _mm_mul_pd(_mm_loadu_pd(a+i), xv));
+      t = _mm_add_pd(t, _mm_mul_pd(_mm_loadu_pd(b+i), xv));
+    }
+
+    double rs[2], rt[2], _h;
+    _mm_storeu_pd(rs, s);
+    _mm_storeu_pd(rt, t);
+
+    double r = dot2_scalar(n-i, a+i, b+i, x+i, &_h);
+    *h = rt[0] + rt[1] + _h;
+
+    return rs[0] + rs[1] + r;
+  }
+
+  /* two floats widened to double: the pair is read as a 64-bit
+     integer lane, with no alignment or aliasing requirement */
+  __attribute__((target("sse2")))
+  inline __m128d loadf2_sse2(const float *p)
+  {
+    return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *) p)));
+  }
+
+  __attribute__((target("sse2")))
+  inline double dotf_sse2(std::size_t n, const float *a, const float *x)
+  {
+    __m128d s = _mm_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+    {
+      s = _mm_add_pd(s, _mm_mul_pd(loadf2_sse2(a+i), loadf2_sse2(x+i)));
+    }
+
+    double r[2];
+    _mm_storeu_pd(r, s);
+
+    return r[0] + r[1] + dotf_scalar(n-i, a+i, x+i);
+  }
+
+  __attribute__((target("sse2")))
+  inline double dot2f_sse2(std::size_t n, const float *a, const float *b,
+                           const float *x, double *h)
+  {
+    __m128d s = _mm_setzero_pd(), t = _mm_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+    {
+      __m128d xv = loadf2_sse2(x+i);
+      __m128d av = loadf2_sse2(a+i);
+      __m128d bv = loadf2_sse2(b+i);
+      s = _mm_add_pd(s, _mm_mul_pd(av, xv));
+      t = _mm_add_pd(t, _mm_mul_pd(bv, xv));
+    }
+
+    double rs[2], rt[2], _h;
+    _mm_storeu_pd(rs, s);
+    _mm_storeu_pd(rt, t);
+
+    double r = dot2f_scalar(n-i, a+i, b+i, x+i, &_h);
+    *h = rt[0] + rt[1] + _h;
+
+    return rs[0] + rs[1] + r;
+  }
+
+  __attribute__((target("sse2")))
+  inline double max_sse2(std::size_t n, const double *x)
+  {
+    __m128d m = _mm_set1_pd(-INFINITY);
+    std::size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+      m = _mm_max_pd(m, _mm_loadu_pd(x+i));
+
+    double r[2];
+    _mm_storeu_pd(r, m);
+
+    double mt = max_scalar(n-i, x+i);
+    double mv = (r[0] > r[1]) ? r[0] : r[1];
+
+    return (mv > mt) ? mv : mt;
+  }
+
+  __attribute__((target("sse2")))
+  inline void scale_sse2(std::size_t n, double alpha, const double *x,
+                         double *y)
+  {
+    __m128d av = _mm_set1_pd(alpha);
+    std::size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_pd(y+i, _mm_mul_pd(av, _mm_loadu_pd(x+i)));
+
+    scale_scalar(n-i, alpha, x+i, y+i);
+  }
+
+  __attribute__((target("sse2")))
+  inline void axpy_sse2(std::size_t n, double alpha, const double *x,
+                        double *y)
+  {
+    __m128d av = _mm_set1_pd(alpha);
+    std::size_t i = 0;
+
+    for (; i + 2 <= n; i += 2)
+      _mm_storeu_pd(y+i, _mm_add_pd(_mm_loadu_pd(y+i),
+                                    _mm_mul_pd(av, _mm_loadu_pd(x+i))));
+
+    axpy_scalar(n-i, alpha, x+i, y+i);
+  }
+
+  /* AVX2 kernels */
+  __attribute__((target("avx2,fma")))
+  inline double dot_avx2(std::size_t n, const double *a, const double *x)
+  {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+      s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(x+i), s0);
+      s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a+i+4), _mm256_loadu_pd(x+i+4), s1);
+    }
+
+    double r[4];
+    _mm256_storeu_pd(r, _mm256_add_pd(s0, s1));
+
+    return (r[0] + r[1]) + (r[2] + r[3]) + dot_sse2(n-i, a+i, x+i);
+  }
+
+  __attribute__((target("avx2,fma")))
+  inline double dot2_avx2(std::size_t n, const double *a, const double *b,
+                          const double *x, double *h)
+  {
+    __m256d s = _mm256_setzero_pd(), t = _mm256_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+      __m256d xv = _mm256_loadu_pd(x+i);
+      s = _mm256_fmadd_pd(_mm256_loadu_pd(a+i), xv, s);
+      t = _mm256_fmadd_pd(_mm256_loadu_pd(b+i), xv, t);
+    }
+
+    double rs[4], rt[4], _h;
+    _mm256_storeu_pd(rs, s);
+    _mm256_storeu_pd(rt, t);
+
+    double r = dot2_sse2(n-i, a+i, b+i, x+i, &_h);
+    *h = (rt[0] + rt[1]) + (rt[2] + rt[3]) + _h;
+
+    return (rs[0] + rs[1]) + (rs[2] + rs[3]) + r;
+  }
+
+  __attribute__((target("avx2,fma")))
+  inline double dotf_avx2(std::size_t n, const float *a, const float *x)
+  {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+      s0 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a+i)),
+                           _mm256_cvtps_pd(_mm_loadu_ps(x+i)), s0);
+      s1 = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a+i+4)),
+                           _mm256_cvtps_pd(_mm_loadu_ps(x+i+4)), s1);
+    }
+
+    double r[4];
+    _mm256_storeu_pd(r, _mm256_add_pd(s0, s1));
+
+    return (r[0] + r[1]) + (r[2] + r[3]) + dotf_sse2(n-i, a+i, x+i);
+  }
+
+  __attribute__((target("avx2,fma")))
+  inline double dot2f_avx2(std::size_t n, const float *a, const float *b,
+                           const float *x, double *h)
+  {
+    __m256d s = _mm256_setzero_pd(), t = _mm256_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+      __m256d xv = _mm256_cvtps_pd(_mm_loadu_ps(x+i));
+      s = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(a+i)), xv, s);
+      t = _mm256_fmadd_pd(_mm256_cvtps_pd(_mm_loadu_ps(b+i)), xv, t);
+    }
+
+    double rs[4], rt[4], _h;
+    _mm256_storeu_pd(rs, s);
+    _mm256_storeu_pd(rt, t);
+
+    double r = dot2f_sse2(n-i, a+i, b+i, x+i, &_h);
+    *h = (rt[0] + rt[1]) + (rt[2] + rt[3]) + _h;
+
+    return (rs[0] + rs[1]) + (rs[2] + rs[3]) + r;
+  }
+
+  __attribute__((target("avx2")))
+  inline double max_avx2(std::size_t n, const double *x)
+  {
+    __m256d m = _mm256_set1_pd(-INFINITY);
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+      m = _mm256_max_pd(m, _mm256_loadu_pd(x+i));
+
+    double r[4];
+    _mm256_storeu_pd(r, m);
+
+    double mt = max_sse2(n-i, x+i);
+    for (int k = 0; k < 4; k++)
+      if (r[k] > mt)
+        mt = r[k];
+
+    return mt;
+  }
+
+  __attribute__((target("avx2")))
+  inline void scale_avx2(std::size_t n, double alpha, const double *x,
+                         double *y)
+  {
+    __m256d av = _mm256_set1_pd(alpha);
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd(y+i, _mm256_mul_pd(av, _mm256_loadu_pd(x+i)));
+
+    scale_scalar(n-i, alpha, x+i, y+i);
+  }
+
+  __attribute__((target("avx2,fma")))
+  inline void axpy_avx2(std::size_t n, double alpha, const double *x,
+                        double *y)
+  {
+    __m256d av = _mm256_set1_pd(alpha);
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd(y+i, _mm256_fmadd_pd(av, _mm256_loadu_pd(x+i),
+                                            _mm256_loadu_pd(y+i)));
+
+    axpy_scalar(n-i, alpha, x+i, y+i);
+  }
+
+  /* AVX-512 kernels */
+  __attribute__((target("avx512f")))
+  inline double hsum_avx512(__m512d v)
+  {
+    double r[8];
+    _mm512_storeu_pd(r, v);
+
+    return ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+  }
+
+  __attribute__((target("avx512f")))
+  inline double hmax_avx512(__m512d v)
+  {
+    double r[8];
+    _mm512_storeu_pd(r, v);
+
+    return max_scalar(8, r);
+  }
+
+  __attribute__((target("avx512f")))
+  inline double dot_avx512(std::size_t n, const double *a, const double *x)
+  {
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+      s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a+i), _mm512_loadu_pd(x+i), s0);
+      s1 = _mm512_fmadd_pd(_mm512_loadu_pd(a+i+8), _mm512_loadu_pd(x+i+8), s1);
+    }
+
+    /* remainder with a masked load */
+    for (; i < n; i += 8)
+    {
+      __mmask8 k = (n-i >= 8) ? 0xff : (__mmask8) ((1u << (n-i)) - 1);
+      s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a+i),
+                           _mm512_maskz_loadu_pd(k, x+i), s0);
+    }
+
+    return hsum_avx512(_mm512_add_pd(s0, s1));
+  }
+
+  __attribute__((target("avx512f")))
+  inline double dot2_avx512(std::size_t n, const double *a, const double *b,
+                            const double *x, double *h)
+  {
+    __m512d s = _mm512_setzero_pd(), t = _mm512_setzero_pd();
+
+    for (std::size_t i = 0; i < n; i += 8)
+    {
+      __mmask8 k = (n-i >= 8) ? 0xff : (__mmask8) ((1u << (n-i)) - 1);
+      __m512d xv = _mm512_maskz_loadu_pd(k, x+i);
+      s = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, a+i), xv, s);
+      t = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, b+i), xv, t);
+    }
+
+    *h = hsum_avx512(t);
+
+    return hsum_avx512(s);
+  }
+
+  /* load of the first min(n, 8) floats of x widened to double */
+  __attribute__((target("avx512f")))
+  inline __m512d loadf_avx512(std::size_t n, const float *x)
+  {
+    __m256 v;
+
+    if (n >= 8)
+      v = _mm256_loadu_ps(x);
+    else
+      v = _mm256_maskload_ps(x, _mm256_cmpgt_epi32(_mm256_set1_epi32((int) n),
+                                                   _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+
+    return _mm512_maskz_cvtps_pd(0xff, v);
+  }
+
+  __attribute__((target("avx512f")))
+  inline double dotf_avx512(std::size_t n, const float *a, const float *x)
+  {
+    __m512d s = _mm512_setzero_pd();
+
+    for (std::size_t i = 0; i < n; i += 8)
+    {
+      s = _mm512_fmadd_pd(loadf_avx512(n-i, a+i),
+                          loadf_avx512(n-i, x+i), s);
+    }
+
+    return hsum_avx512(s);
+  }
+
+  __attribute__((target("avx512f")))
+  inline double dot2f_avx512(std::size_t n, const float *a, const float *b,
+                             const float *x, double *h)
+  {
+    __m512d s = _mm512_setzero_pd(), t = _mm512_setzero_pd();
+
+    for (std::size_t i = 0; i < n; i += 8)
+    {
+      __m512d xv = loadf_avx512(n-i, x+i);
+      s = _mm512_fmadd_pd(loadf_avx512(n-i, a+i), xv, s);
+      t = _mm512_fmadd_pd(loadf_avx512(n-i, b+i), xv, t);
+    }
+
+    *h = hsum_avx512(t);
+
+    return hsum_avx512(s);
+  }
+
+  __attribute__((target("avx512f")))
+  inline double max_avx512(std::size_t n, const double *x)
+  {
+    __m512d m = _mm512_set1_pd(-INFINITY);
+
+    for (std::size_t i = 0; i < n; i += 8)
+    {
+      __mmask8 k = (n-i >= 8) ? 0xff : (__mmask8) ((1u << (n-i)) - 1);
+      m = _mm512_mask_max_pd(m, k, m, _mm512_maskz_loadu_pd(k, x+i));
+    }
+
+    return hmax_avx512(m);
+  }
+
+  __attribute__((target("avx512f")))
+  inline void scale_avx512(std::size_t n, double alpha, const double *x,
+                           double *y)
+  {
+    __m512d av = _mm512_set1_pd(alpha);
+
+    for (std::size_t i = 0; i < n; i += 8)
+    {
+      __mmask8 k = (n-i >= 8) ? 0xff : (__mmask8) ((1u << (n-i)) - 1);
+      _mm512_mask_storeu_pd(y+i, k, _mm512_mul_pd(av, _mm512_maskz_loadu_pd(k, x+i)));
+    }
+  }
+
+  __attribute__((target("avx512f")))
+  inline void axpy_avx512(std::size_t n, double alpha, const double *x,
+                          double *y)
+  {
+    __m512d av = _mm512_set1_pd(alpha);
+
+    for (std::size_t i = 0; i < n; i += 8)
+    {
+      __mmask8 k = (n-i >= 8) ? 0xff : (__mmask8) ((1u << (n-i)) - 1);
+      _mm512_mask_storeu_pd(y+i, k,
+        _mm512_fmadd_pd(av, _mm512_maskz_loadu_pd(k, x+i),
+                        _mm512_maskz_loadu_pd(k, y+i)));
+    }
+  }
+#endif
+
+  /* kernels of one instruction set */
+  struct kernels {
+    const char *isa;
+    double (*dot)(std::size_t, const double*, const double*);
+    double (*dot2)(std::size_t, const double*, const double*, const double*, double*);
+    double (*max)(std::size_t, const double*);
+    void (*scale)(std::size_t, double, const double*, double*);
+    void (*axpy)(std::size_t, double, const double*, double*);
+    double (*dotf)(std::size_t, const float*, const float*);
+    double (*dot2f)(std::size_t, const float*, const float*, const float*, double*);
+  };
+
+  /* widest instruction set supported by the CPU */
+  inline kernels select()
+  {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+      return { "avx512", dot_avx512, dot2_avx512, max_avx512, scale_avx512, axpy_avx512,
+             dotf_avx512, dot2f_avx512 };
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      return { "avx2", dot_avx2, dot2_avx2, max_avx2, scale_avx2, axpy_avx2,
+             dotf_avx2, dot2f_avx2 };
+
+    if (__builtin_cpu_supports("sse2"))
+      return { "sse2", dot_sse2, dot2_sse2, max_sse2, scale_sse2, axpy_sse2,
+             dotf_sse2, dot2f_sse2 };
+#endif
+
+    return { "scalar", dot_scalar, dot2_scalar, max_scalar, scale_scalar, axpy_scalar,
+             dotf_scalar, dot2f_scalar };
+  }
+
+  /* kernels selected at the first call */
+  inline const kernels& get()
+  {
+    static const kernels k = select();
+
+    return k;
+  }
+}
+#endif
@@ -0,0 +1,450 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SPARSE_LIKELIHOOD_HPP
+#define SPARSE_LIKELIHOOD_HPP
+#include <iostream>
+#include <cstdlib>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "util.hpp"
+#include "constants.h"
+#include "arena.hpp"
+#include "likelihood.hpp"
+
+/* sparse likelihood multidimensional array class: the array
+   s[0] x ... x s[N] is stored as a s[0] by s[1] x ... x s[N]
+   matrix in CSR format, i.e. by outcome, with the non-zero
+   values of each outcome sorted by joint state index (col)
+   and, for each of them, the index of each state factor (idx);
+   alogA holds the products of the values by their logarithm */
+template <typename T>
+class sparse_likelihood {
+private:
+  std::vector<std::size_t> s;
+  std::size_t Nnz;
+  std::size_t *row_ptr;
+  std::size_t *col;
+  unsigned int *idx;
+  T *data;
+  T *alogA;
+
+  /* joint state index of the index tuple sq; the states of a
+     factor with a dimension of size 1 are broadcast to index 0 */
+  template <typename I>
+  std::size_t joint(const std::vector<I>& sq) const
+  {
+    std::size_t ind = 0;
+
+    for (std::size_t j = 0; j < sq.size(); ++j)
+      ind = ind * s[j+1] + ((s[j+1] == 1) ? 0 : sq[j]);
+
+    return ind;
+  }
+
+  /* position of the element (k, ind) in data, -1 if it is zero */
+  long position(std::size_t k, std::size_t ind) const
+  {
+    auto begin = col + row_ptr[k];
+    auto end = col + row_ptr[k+1];
+    auto it = std::lower_bound(begin, end, ind);
+
+    if (it == end || *it != ind)
+      return -1;
+
+    return it - col;
+  }
+
+public:
+  /* constructor by passing a dense likelihood */
+  template <typename L>
+  sparse_likelihood(L& A)
+  {
+    auto ia = A.GetIndexArray();
+    s.assign(ia.begin(), ia.end());
+
+    std::size_t n = s.size()-1;
+    std::size_t m = A.get_tnc()/s[0];
+
+    Nnz = 0;
+    for (std::size_t e = 0; e < A.get_tnc(); ++e)
+      if (A[e] != 0.0)
+        Nnz++;
+
+    row_ptr = new std::size_t[s[0]+1];
+    col = new std::size_t[Nnz];
+    idx = new unsigned int[Nnz*n];
+    data = new T[Nnz];
+    alogA = new T[Nnz];
+
+    std::size_t nz = 0;
+    for (std::size_t k = 0; k < s[0]; ++k)
+    {
+      row_ptr[k] = nz;
+
+      for (std::size_t j = 0; j < m; ++j)
+        if (A[k*m+j] != 0.0)
+        {
+          col[nz] = j;
+          data[nz] = A[k*m+j];
+
+          for (std::size_t i = n, r = j; i-- > 0; r /= s[i+1])
+            idx[nz*n+i] = r % s[i+1];
+
+          nz++;
+        }
+    }
+    row_ptr[s[0]] = nz;
+
+    for (std::size_t e = 0; e < Nnz; ++e)
+      alogA[e] = data[e] * _log(data[e]);
+  }
+
+  sparse_likelihood(const sparse_likelihood&) = delete;
+  sparse_likelihood& operator=(const sparse_likelihood&) = delete;
+
+  ~sparse_likelihood()
+  {
+    delete [] row_ptr;
+    delete [] col;
+    delete [] idx;
+    delete [] data;
+    delete [] alogA;
+  }
+
+  /* fraction of non-zero elements of the dense likelihood A */
+  template <typename L>
+  static T density(L& A)
+  {
+    std::size_t nz = 0;
+
+    for (std::size_t e = 0; e < A.get_tnc(); ++e)
+      if (A[e] != 0.0)
+        nz++;
+
+    return (T) nz / A.get_tnc();
+  }
+
+  /* normalization along the outcomes */
+  void Norm()
+  {
+    std::size_t m = get_tnc()/s[0];
+    std::vector<T> sum(m, 0.0);
+
+    for (std::size_t e = 0; e < Nnz; ++e)
+      sum[col[e]] += data[e];
+
+    for (std::size_t e = 0; e < Nnz; ++e)
+    {
+      data[e] /= sum[col[e]];
+      alogA[e] = data[e] * _log(data[e]);
+    }
+  }
+
+  /* sum of this object and of the sparse likelihood b given
+     as a parameter: the non-zero elements are the union of
+     the non-zero elements of both */
+  void sum(const sparse_likelihood& b)
+  {
+    std::size_t n = s.size()-1;
+
+    std::vector<std::size_t> _row_ptr(s[0]+1);
+    std::vector<std::size_t> _col;
+    std::vector<unsigned int> _idx;
+    std::vector<T> _data;
+
+    for (std::size_t k = 0; k < s[0]; ++k)
+    {
+      _row_ptr[k] = _col.size();
+
+      std::size_t e = row_ptr[k], f = b.row_ptr[k];
+
+      while (e < row_ptr[k+1] || f < b.row_ptr[k+1])
+      {
+        if (f == b.row_ptr[k+1] || (e < row_ptr[k+1] && col[e] < b.col[f]))
+        {
+          _col.push_back(col[e]);
+          _idx.insert(_idx.end(), &idx[e*n], &idx[e*n]+n);
+          _data.push_back(data[e++]);
+        }
+        else if (e == row_ptr[k+1] || b.col[f] < col[e])
+        {
+          _col.push_back(b.col[f]);
+          _idx.insert(_idx.end(), &b.idx[f*n], &b.idx[f*n]+n);
+          _data.push_back(b.data[f++]);
+        }
+        else
+        {
+          _col.push_back(col[e]);
+          _idx.insert(_idx.end(), &idx[e*n], &idx[e*n]+n);
+          _data.push_back(data[e++] + b.data[f++]);
+        }
+      }
+    }
+    _row_ptr[s[0]] = _col.size();
+
+    delete [] row_ptr;
+    delete [] col;
+    delete [] idx;
+    delete [] data;
+    delete [] alogA;
+
+    Nnz = _col.size();
+
+    row_ptr = new std::size_t[s[0]+1];
+    col = new std::size_t[Nnz];
+    idx = new unsigned int[Nnz*n];
+    data = new T[Nnz];
+    alogA = new T[Nnz];
+
+    std::copy(_row_ptr.begin(), _row_ptr.end(), row_ptr);
+    std::copy(_col.begin(), _col.end(), col);
+    std::copy(_idx.begin(), _idx.end(), idx);
+    std::copy(_data.begin(), _data.end(), data);
+
+    for (std::size_t e = 0; e < Nnz; ++e)
+      alogA[e] = data[e] * _log(data[e]);
+  }
+
+  /* return order (rank) */
+  std::size_t get_order()
+  {
+    return s.size();
+  }
+
+  /* return size of first dimension */
+  std::size_t get_firstdimension()
+  {
+    return s[0];
+  }
+
+  /* return total number of elements of the dense array */
+  std::size_t get_tnc()
+  {
+    std::size_t m = 1;
+
+    for (std::size_t val: s)
+      m *= val;
+
+    return m;
+  }
+
+  /* return number of non-zero elements */
+  std::size_t get_nnz()
+  {
+    return Nnz;
+  }
+
+  /* return the index of the first dimension with maximum value
+     in t(:,a[0],...,a[N-1]) */
+  int MaxIndex(const std::vector<std::size_t>& a) const
+  {
+    std::size_t ind = joint(a);
+
+    T max = -INFINITY;
+    int maxind = -1;
+
+    for (std::size_t k = 0; k < s[0]; ++k)
+    {
+      long e = position(k, ind);
+      T val = (e < 0) ? 0.0 : data[e];
+
+      if (val > max)
+      {
+        max = val;
+        maxind = k;
+      }
+    }
+
+    return maxind;
+  }
+
+  /* extract the elements corresponding to the index tuple sq
+     along dimension f and store them in a 2D array */
+  T **Dot(std::vector<int> sq, std::size_t f)
+  {
+    std::size_t n = s.size()-1;
+
+    T **_Ag = new T*[s[0]];
+    for (std::size_t k = 0; k < s[0]; ++k)
+    {
+      _Ag[k] = new T[s[f+1]];
+      for (std::size_t i = 0; i < s[f+1]; ++i)
+        _Ag[k][i] = 0.0;
+    }
+
+    for (std::size_t k = 0; k < s[0]; ++k)
+      for (std::size_t e = row_ptr[k]; e < row_ptr[k+1]; ++e)
+      {
+        std::size_t i = 0;
+        while (i < n && (i == f || s[i+1] == 1 ||
+                         idx[e*n+i] == (unsigned int) sq[i]))
+          i++;
+
+        if (i == n)
+          _Ag[k][idx[e*n+f]] = data[e];
+      }
+
+    return _Ag;
+  }
+
+  /* elements t(o,sq[0],...,:,...,sq[N-1]) along dimension f of
+     the outcome o, i.e. the row o of Dot(sq, f), gathered in v
+     of s[f+1] elements; the result is a view of v */
+  fibre<T> Fibre(std::size_t o, const std::vector<int>& sq, std::size_t f,
+                 T *v) const
+  {
+    std::size_t ind = 0;
+    std::size_t stride = 1;
+
+    for (std::size_t j = 0; j < sq.size(); ++j)
+    {
+      ind = ind * s[j+1] + ((j == f || s[j+1] == 1) ? 0 : sq[j]);
+      if (j > f)
+        stride *= s[j+1];
+    }
+
+    /* the joint indices of the fibre are increasing: a single
+       pass over the non-zero elements of the outcome o */
+    const std::size_t *it = std::lower_bound(col + row_ptr[o],
+                                             col + row_ptr[o+1], ind);
+    const std::size_t *end = col + row_ptr[o+1];
+
+    for (std::size_t i = 0; i < s[f+1]; ++i, ind += stride)
+    {
+      it = std::lower_bound(it, end, ind);
+      v[i] = (it != end && *it == ind) ? data[it - col] : 0.0;
+    }
+
+    return { v, s[f+1], 1 };
+  }
+
+  /* find the elements t(:,sq[0],...,sq[N-1]) and store them in p */
+  void find(std::vector<int> sq, std::vector<T> &p)
+  {
+    std::size_t ind = joint(sq);
+
+    for (std::size_t k = 0; k < s[0]; ++k)
+    {
+      long e = position(k, ind);
+      p.at(k) = (e < 0) ? 0.0 : data[e];
+    }
+  }
+
+  /* multidimensional dot (inner) product and epistemic value
+     of the joint belief x, i.e. of the outer product of the
+     hidden state beliefs; the result is taken from the arena a */
+  T *HDot(T *x, T *H, Arena& a)
+  {
+    T *_q = a.Alloc<T>(s[0]);
+
+    typename accumulator<T>::type sum_H = 0;
+
+    for (std::size_t k = 0; k < s[0]; ++k)
+    {
+      typename accumulator<T>::type sum = 0, sum_k = 0;
+
+      for (std::size_t e = row_ptr[k]; e < row_ptr[k+1]; ++e)
+      {
+        T xval = x[col[e]];
+
+        sum += data[e] * xval;
+        sum_k += alogA[e] * xval;
+      }
+
+      _q[k] = sum;
+      sum_H += sum_k;
+    }
+
+    *H = sum_H;
+
+    return _q;
+  }
+
+  /* multidimensional dot (inner) product and epistemic value
+     of the hidden state beliefs xt[i], without the joint belief:
+     the belief of each non-zero element is the product of the
+     beliefs of its state factors; the result is taken from
+     the arena a */
+  T *HDot(T **xt, T *H, Arena& a)
+  {
+    std::size_t n = s.size()-1;
+
+    T *_q = a.Alloc<T>(s[0]);
+
+    typename accumulator<T>::type sum_H = 0;
+
+    for (std::size_t k = 0; k < s[0]; ++k)
+    {
+      typename accumulator<T>::type sum = 0, sum_k = 0;
+
+      for (std::size_t e = row_ptr[k]; e < row_ptr[k+1]; ++e)
+      {
+        T xval = xt[0][idx[e*n]];
+        for (std::size_t i = 1; i < n; ++i)
+          xval *= xt[i][idx[e*n+i]];
+
+        sum += data[e] * xval;
+        sum_k += alogA[e] * xval;
+      }
+
+      _q[k] = sum;
+      sum_H += sum_k;
+    }
+
+    *H = sum_H;
+
+    return _q;
+  }
+
+  /* likelihood of the outcome o along dimension f marginalised
+     over the other state factors: v[i] is the sum of the products
+     of the elements t(o,...,i,...) and the vectors xt[j], j != f */
+  void Marginal(std::size_t o, T **xt, std::size_t f, T *v)
+  {
+    std::size_t n = s.size()-1;
+
+    for (std::size_t i = 0; i < s[f+1]; i++)
+      v[i] = 0.0;
+
+    for (std::size_t e = row_ptr[o]; e < row_ptr[o+1]; ++e)
+    {
+      T product = data[e];
+
+      for (std::size_t i = 0; i < n; i++)
+        if (i != f)
+          product *= xt[i][idx[e*n+i]];
+
+      v[idx[e*n+f]] += product;
+    }
+  }
+};
+#endif
@@ -94,6 +94,17 @@ public:
       id[i] = s.id[i];
   }
 
+  /* copy of the first T_ elements of s, the ones past the end of s
+     set to zero */
+  States(const States &s, unsigned int T_)
+  {
+    this->T = T_;
+
+    id = new unsigned int [this->T];
+    for(std::size_t i = 0; i < this->T; i++)
+      id[i] = (i < s.T) ? s.id[i] : 0;
+  }
+
   ~States() {
       delete [] id;
   }
@@ -0,0 +1,288 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "mdp.hpp"
+
+/* sweep of episodes over a grid of parameters: the model of each
+   point of the grid is built once and its episodes, one for each
+   seed, are run by clones sharing it. The episodes are scheduled on
+   a pool of threads, each thread taking them from the front of its
+   own queue and, once empty, from the back of the queues of the
+   others (work stealing); each episode is run by a single thread,
+   with the OpenMP regions inside it serial */
+template <typename Ty, std::size_t M>
+class Sweep {
+public:
+  /* model of a point of the grid: the components are owned by the
+     sweep and deleted, with the MDP built from them, at the end */
+  struct Model {
+    std::vector<Beliefs<Ty>*> D; /* initial state probabilities */
+    std::vector<States*> S; /* true initial state */
+    std::vector<std::vector<Transitions<Ty>*>> B; /* transition probabilities */
+    std::vector<std::vector<likelihood<Ty,M>*>> A; /* observation model */
+#ifdef WITH_GP
+    std::vector<std::vector<likelihood<Ty,M>*>> AA; /* observation process */
+#endif
+    std::vector<Priors<Ty>*> C; /* terminal cost probabilities */
+    MDP<Ty,M> *mdp;
+
+    Model() : mdp(NULL) {}
+
+    ~Model() {
+      delete mdp;
+
+      std::for_each(D.begin(), D.end(), delete_pointed_to<Beliefs<Ty>>);
+      std::for_each(S.begin(), S.end(), delete_pointed_to<States>);
+      for (auto& b: B)
+        std::for_each(b.begin(), b.end(), delete_pointed_to<Transitions<Ty>>);
+      for (auto& a: A)
+        std::for_each(a.begin(), a.end(), delete_pointed_to<likelihood<Ty,M>>);
+#ifdef WITH_GP
+      for (auto& a: AA)
+        std::for_each(a.begin(), a.end(), delete_pointed_to<likelihood<Ty,M>>);
+#endif
+      std::for_each(C.begin(), C.end(), delete_pointed_to<Priors<Ty>>);
+    }
+  };
+
+  /* build the components and the MDP of the model of a point of the
+     grid (values of the parameters) */
+  typedef std::function<void(const std::vector<int>&, Model&)> Builder;
+
+  /* agent of an episode sharing the model m, with the true initial
+     state and the seed given */
+  typedef std::function<MDP<Ty,M>*(MDP<Ty,M>&, std::vector<States*>&,
+                                   unsigned int)> Cloner;
+
+  /* columns of the result of an episode, written after the values
+     of the parameters and the seed */
+  typedef std::function<void(MDP<Ty,M>&, std::ostream&)> Recorder;
+
+protected:
+  std::vector<std::string> names; /* parameters */
+  std::vector<std::vector<int>> values; /* values of each parameter */
+  Builder build;
+  unsigned int Nseeds; /* episodes of each point */
+  unsigned int seed; /* seed of the first episode of each point */
+  unsigned int nt; /* number of threads */
+
+  /* values of the parameters of the p-th point of the grid, the
+     last parameter varying fastest */
+  std::vector<int> point(std::size_t p)
+  {
+    std::vector<int> v(values.size());
+
+    for (std::size_t i = values.size(); i-- > 0; )
+    {
+      v[i] = values[i][p % values[i].size()];
+      p /= values[i].size();
+    }
+
+    return v;
+  }
+
+public:
+  /* agent of the episodes: by default a clone of the model (MDP) */
+  Cloner clone;
+
+  /* columns of the result: by default the actions of the episode */
+  Recorder record;
+
+  /* column names of the recorder */
+  std::string header;
+
+  Sweep(std::vector<std::string>& names_, /* parameters */
+        std::vector<std::vector<int>>& values_, /* values of each parameter */
+        Builder build_, unsigned int Nseeds_ = 1, unsigned int seed_ = 0,
+        unsigned int nt_ = 1) :
+    names(names_), values(values_), build(build_),
+    Nseeds(Nseeds_), seed(seed_), nt(nt_)
+  {
+    if (names.size() != values.size())
+    {
+      std::cerr << "Sweep: one vector of values for each parameter is needed" << std::endl;
+      exit(-1);
+    }
+
+    if (nt == 0)
+      nt = 1;
+
+    clone = [](MDP<Ty,M>& m, std::vector<States*>& S, unsigned int s) {
+      return new MDP<Ty,M>(m, S, s);
+    };
+
+    record = [](MDP<Ty,M>& m, std::ostream& out) {
+      for (unsigned int t = 0; t < m.getTw(); t++)
+        out << (t ? " " : "") << m.getU(t);
+    };
+
+    header = "actions";
+  }
+
+  /* number of points of the grid */
+  std::size_t size()
+  {
+    std::size_t Np = 1;
+
+    for (auto& v: values)
+      Np *= v.size();
+
+    return Np;
+  }
+
+  /* run the episodes of all the points of the grid and write their
+     results to out as comma-separated values, one line for each
+     episode in order of point and seed */
+  void run(std::ostream& out)
+  {
+    std::size_t Np = size();
+    std::size_t Ne = Np*Nseeds;
+
+    /* the models are built (and compiled) one at a time */
+    std::vector<Model*> models(Np);
+    for (std::size_t p = 0; p < Np; p++)
+    {
+      models[p] = new Model;
+      build(point(p), *models[p]);
+
+      if (!models[p]->mdp)
+      {
+        std::cerr << "Sweep: no model built for point " << p << std::endl;
+        exit(-1);
+      }
+
+      models[p]->mdp->compile();
+    }
+
+    std::vector<std::string> rows(Ne);
+
+    /* queues of the threads: contiguous blocks of episodes */
+    std::vector<std::deque<std::size_t>> queue(nt);
+    std::vector<std::mutex> lock(nt);
+    for (std::size_t e = 0; e < Ne; e++)
+      queue[e*nt/Ne].push_back(e);
+
+    auto episode = [&](std::size_t e) {
+      std::size_t p = e / Nseeds;
+      unsigned int s = seed + e % Nseeds;
+      Model& m = *models[p];
+
+      std::vector<States*> S;
+      for (unsigned int i = 0; i < m.S.size(); i++)
+        S.push_back(new States(*m.S[i], m.mdp->getTw()));
+
+      MDP<Ty,M> *agent = clone(*m.mdp, S, s);
+
+      agent->active_inference();
+
+      std::ostringstream row;
+      for (int v: point(p))
+        row << v << ",";
+      row << s << ",";
+      record(*agent, row);
+
+      rows[e] = row.str();
+
+      delete agent;
+      std::for_each(S.begin(), S.end(), delete_pointed_to<States>);
+    };
+
+    auto worker = [&](unsigned int w) {
+#ifdef _OPENMP
+      omp_set_num_threads(1);
+#endif
+      for (;;)
+      {
+        std::size_t e = 0;
+        bool found = false;
+
+        /* own queue first, from the front */
+        {
+          std::lock_guard<std::mutex> guard(lock[w]);
+          if (!queue[w].empty())
+          {
+            e = queue[w].front();
+            queue[w].pop_front();
+            found = true;
+          }
+        }
+
+        /* then the others, from the back */
+        for (unsigned int v = 1; v < nt && !found; v++)
+        {
+          unsigned int o = (w + v) % nt;
+
+          std::lock_guard<std::mutex> guard(lock[o]);
+          if (!queue[o].empty())
+          {
+            e = queue[o].back();
+            queue[o].pop_back();
+            found = true;
+          }
+        }
+
+        /* no episodes are added while running: all taken */
+        if (!found)
+          return;
+
+        episode(e);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int w = 0; w < nt; w++)
+      threads.emplace_back(worker, w);
+    for (auto& t: threads)
+      t.join();
+
+    for (auto& n: names)
+      out << n << ",";
+    out << "seed," << header << std::endl;
+
+    for (auto& r: rows)
+      out << r << std::endl;
+
+    std::for_each(models.begin(), models.end(), delete_pointed_to<Model>);
+  }
+};
+#endif
@@ -0,0 +1,256 @@
+// BSD 3-Clause License
+
+// Copyright (c) 2022, Francesco Gregoretti
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+
+// 3. Neither the name of the copyright holder nor the names of its
+//    contributors may be used to endorse or promote products derived from
+//    this software without specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef TRAINER_HPP
+#define TRAINER_HPP
+#include <iostream>
+#include <vector>
+#include <functional>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "mdp.hpp"
+
+#ifdef STREAMING
+#error "Trainer needs the histories of whole episodes (STREAMING not defined)"
+#endif
+
+#ifdef LEARNING
+/* learning over many episodes run concurrently: the episodes of a
+   round are run by a team of threads against the parameters frozen
+   at the beginning of the round; each thread accumulates the
+   Dirichlet counts of its episodes into its own copy of the
+   parameters and the differences are reduced, in order of thread,
+   into the parameters at the end of the round, so that the result
+   only depends on the seed and on the number of threads */
+template <typename Ty, std::size_t M>
+class Trainer {
+public:
+  /* model of an episode, built from the initial states and the
+     parameters given (owned by the trainer) and the seed */
+  typedef std::function<MDP<Ty,M>*(std::vector<Beliefs<Ty>*>&,
+                                   std::vector<States*>&,
+                                   std::vector<std::vector<Transitions<Ty>*>>&,
+                                   std::vector<std::vector<likelihood<Ty,M>*>>&,
+                                   std::vector<Priors<Ty>*>&,
+                                   unsigned int)> Builder;
+
+protected:
+  std::vector<Beliefs<Ty>*>& _d;
+  std::vector<States*>& _s;
+  std::vector<std::vector<Transitions<Ty>*>>& _b;
+  std::vector<std::vector<likelihood<Ty,M>*>>& _a;
+  std::vector<Priors<Ty>*>& _c;
+  Builder build;
+  Ty eta; /* learning rate */
+  unsigned int nt; /* number of threads */
+
+  /* copy of the parameters: the model normalises them in place */
+  void copy(std::vector<Beliefs<Ty>*>& d,
+            std::vector<std::vector<Transitions<Ty>*>>& b,
+            std::vector<std::vector<likelihood<Ty,M>*>>& a,
+            std::vector<Priors<Ty>*>& c)
+  {
+    for (unsigned int i = 0; i < _d.size(); i++)
+      d.push_back(new Beliefs<Ty>(*_d[i]));
+
+    b.resize(_b.size());
+    for (unsigned int i = 0; i < _b.size(); i++)
+      for (unsigned int j = 0; j < _b[i].size(); j++)
+        b[i].push_back(new Transitions<Ty>(*_b[i][j]));
+
+    a.resize(_a.size());
+    for (unsigned int g = 0; g < _a.size(); g++)
+      for (unsigned int j = 0; j < _a[g].size(); j++)
+      {
+        a[g].push_back(new likelihood<Ty,M>(_a[g][j]->GetIndexArray()));
+        *a[g][j] = *_a[g][j];
+      }
+
+    for (unsigned int g = 0; g < _c.size(); g++)
+      c.push_back(new Priors<Ty>(*_c[g]));
+  }
+
+  void release(std::vector<Beliefs<Ty>*>& d,
+               std::vector<std::vector<Transitions<Ty>*>>& b,
+               std::vector<std::vector<likelihood<Ty,M>*>>& a,
+               std::vector<Priors<Ty>*>& c)
+  {
+    std::for_each(d.begin(), d.end(), delete_pointed_to<Beliefs<Ty>>);
+    for (unsigned int i = 0; i < b.size(); i++)
+      std::for_each(b[i].begin(), b[i].end(), delete_pointed_to<Transitions<Ty>>);
+    for (unsigned int g = 0; g < a.size(); g++)
+      std::for_each(a[g].begin(), a[g].end(), delete_pointed_to<likelihood<Ty,M>>);
+    std::for_each(c.begin(), c.end(), delete_pointed_to<Priors<Ty>>);
+  }
+
+public:
+  /* parameters learned */
+  bool learn_A;
+  bool learn_B;
+  bool learn_C;
+  bool learn_D;
+
+  Trainer(std::vector<Beliefs<Ty>*>& __d, /* initial state counts */
+          std::vector<States*>& __S, /* true initial state */
+          std::vector<std::vector<Transitions<Ty>*>>& __b, /* transition counts */
+          std::vector<std::vector<likelihood<Ty,M>*>>& __a, /* likelihood counts */
+          std::vector<Priors<Ty>*>& __c, /* preference counts */
+          Builder build_, Ty eta_ = 1, unsigned int nt_ = 1) :
+    _d(__d), _s(__S), _b(__b), _a(__a), _c(__c),
+    build(build_), eta(eta_), nt(nt_),
+    learn_A(true), learn_B(true), learn_C(false), learn_D(true)
+  {
+    if (_d.size() != _s.size() || _b.size() != _s.size())
+    {
+      std::cerr << "__S, __d and __b are not consistent" << std::endl;
+      exit(-1);
+    }
+
+#ifndef _OPENMP
+    nt = 1;
+#endif
+    if (nt == 0)
+      nt = 1;
+  }
+
+  /* Dirichlet counts of the episode run by the model m */
+  virtual void learn(MDP<Ty,M> *m,
+                     std::vector<Beliefs<Ty>*>& d,
+                     std::vector<std::vector<Transitions<Ty>*>>& b,
+                     std::vector<std::vector<likelihood<Ty,M>*>>& a,
+                     std::vector<Priors<Ty>*>& c)
+  {
+    /* the episode may have stopped before the temporal horizon */
+    for (unsigned int tt = 0; tt < m->getTw() && m->getU(tt) >= 0; tt++)
+    {
+      if (learn_A)
+        m->update_A(a, eta, tt);
+      if (learn_B && tt > 0)
+        m->update_B(b, eta, tt);
+      if (learn_C)
+        m->update_C(c, eta, tt);
+    }
+
+    if (learn_D)
+      m->update_D(d, eta, 0);
+  }
+
+  /* run Ne episodes (of seeds seed, seed+1, ...) and update the
+     parameters with their Dirichlet counts */
+  void round(unsigned int Ne, unsigned int seed)
+  {
+    /* counts accumulated by each thread, starting from a copy of
+       the parameters */
+    std::vector<std::vector<Beliefs<Ty>*>> dw(nt);
+    std::vector<std::vector<std::vector<Transitions<Ty>*>>> bw(nt);
+    std::vector<std::vector<std::vector<likelihood<Ty,M>*>>> aw(nt);
+    std::vector<std::vector<Priors<Ty>*>> cw(nt);
+    unsigned int nw = 1; /* number of threads of the team */
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(nt)
+#endif
+    {
+#ifdef _OPENMP
+      unsigned int w = omp_get_thread_num();
+
+      #pragma omp single
+      nw = omp_get_num_threads();
+#else
+      unsigned int w = 0;
+#endif
+
+      copy(dw[w], bw[w], aw[w], cw[w]);
+
+      /* episodes are assigned to the threads in contiguous blocks */
+#ifdef _OPENMP
+      #pragma omp for schedule(static)
+#endif
+      for (unsigned int e = 0; e < Ne; e++)
+      {
+        std::vector<Beliefs<Ty>*> d;
+        std::vector<std::vector<Transitions<Ty>*>> b;
+        std::vector<std::vector<likelihood<Ty,M>*>> a;
+        std::vector<Priors<Ty>*> c;
+        copy(d, b, a, c);
+
+        std::vector<States*> s;
+        for (unsigned int i = 0; i < _s.size(); i++)
+          s.push_back(new States(*_s[i]));
+
+        MDP<Ty,M> *m = build(d, s, b, a, c, seed+e);
+        m->active_inference();
+        learn(m, dw[w], bw[w], aw[w], cw[w]);
+        delete m;
+
+        std::for_each(s.begin(), s.end(), delete_pointed_to<States>);
+        release(d, b, a, c);
+      }
+
+      /* counts of the thread */
+      for (unsigned int i = 0; i < _d.size(); i++)
+        dw[w][i]->sum(*_d[i], -1);
+      for (unsigned int i = 0; i < _b.size(); i++)
+        for (unsigned int j = 0; j < _b[i].size(); j++)
+          bw[w][i][j]->sum(*_b[i][j], -1);
+      for (unsigned int g = 0; g < _a.size(); g++)
+        for (unsigned int j = 0; j < _a[g].size(); j++)
+          aw[w][g][j]->sum(*_a[g][j], -1);
+      for (unsigned int g = 0; g < _c.size(); g++)
+        cw[w][g]->sum(*_c[g], -1);
+    }
+
+    /* reduction in order of thread, parallel over the elements */
+    for (unsigned int w = 0; w < nw; w++)
+    {
+      for (unsigned int i = 0; i < _d.size(); i++)
+        _d[i]->sum(*dw[w][i], 1);
+      for (unsigned int i = 0; i < _b.size(); i++)
+        for (unsigned int j = 0; j < _b[i].size(); j++)
+          _b[i][j]->sum(*bw[w][i][j], 1);
+      for (unsigned int g = 0; g < _a.size(); g++)
+        for (unsigned int j = 0; j < _a[g].size(); j++)
+          _a[g][j]->sum(*aw[w][g][j], 1);
+      for (unsigned int g = 0; g < _c.size(); g++)
+        _c[g]->sum(*cw[w][g], 1);
+
+      release(dw[w], bw[w], aw[w], cw[w]);
+    }
+  }
+
+  /* run Nr rounds of Ne episodes each */
+  void run(unsigned int Nr, unsigned int Ne, unsigned int seed)
+  {
+    for (unsigned int r = 0; r < Nr; r++)
+      round(Ne, seed + r*Ne);
+  }
+};
+#endif
+#endif
@@ -38,12 +38,22 @@
 #include <vector>
 #include "util.hpp"
 #include "constants.h"
+#include "arena.hpp"
 
 /* transition probabilities matrix class
    with size of Ns by Ns, stored in CSR
-   format with Nnz non-zero values */
+   format with Nnz non-zero values; the
+   structure can be mirrored in CSC format
+   (see CSC) for the column accesses */
 template <typename T>
 class Transitions {
+public:
+  /* structure of the matrix, detected by Norm, Eye, csc_tocsr
+     and the constructors: identity, functional map (a single
+     element, equal to 1, in each column c, in row next[c]) or
+     general */
+  enum Kind { GENERAL, IDENTITY, FUNCTIONAL };
+
 protected:
   unsigned int Ns;
   unsigned int Nnz;
@@ -51,6 +61,83 @@ private:
   unsigned int *col;
   unsigned int *row_ptr;
   T *data;
+  /* CSC mirror of the structure, NULL if not kept: the
+     elements of column c are data[pos[k]] in row row[k],
+     k=col_ptr[c],...,col_ptr[c+1]-1, in increasing row order;
+     the values are read from data, so that Norm and SetData
+     keep the mirror consistent */
+  unsigned int *col_ptr;
+  unsigned int *row;
+  unsigned int *pos;
+  Kind kind;
+  unsigned int *next; /* NULL if kind is GENERAL */
+
+  void clear_kind()
+  {
+    delete [] next;
+    next = NULL;
+    kind = GENERAL;
+  }
+
+  /* detect the structure of the matrix */
+  void Detect()
+  {
+    clear_kind();
+
+    if (Nnz != Ns)
+      return;
+
+    unsigned int *_next = new unsigned int[Ns];
+    std::fill(_next, _next + Ns, Ns);
+
+    bool identity = true;
+
+    for(unsigned int i = 0; i < Ns; i++)
+      for(unsigned int k = row_ptr[i]; k < row_ptr[i+1]; k++)
+      {
+        if (data[k] != 1 || _next[col[k]] != Ns)
+        {
+          delete [] _next;
+          return;
+        }
+
+        _next[col[k]] = i;
+        identity = identity && (col[k] == i);
+      }
+
+    next = _next;
+    kind = identity ? IDENTITY : FUNCTIONAL;
+  }
+
+  /* y = Tx for the identity and the functional maps, in O(Ns):
+     a copy or a scatter of the elements of x (x != y for the
+     functional maps) */
+  void apply_map(T *x, T *y)
+  {
+    if (kind == IDENTITY)
+    {
+      if (x != y)
+        std::copy(x, x + Ns, y);
+
+      return;
+    }
+
+    std::fill(y, y + Ns, 0.0);
+
+    for(unsigned int c = 0; c < Ns; c++)
+      y[next[c]] += x[c];
+  }
+
+  /* sum of the Ns elements of x */
+  T sum(const T *x) const
+  {
+    typename accumulator<T>::type _sum = 0.0;
+
+    for(unsigned int j = 0; j < Ns; j++)
+      _sum += x[j];
+
+    return _sum;
+  }
 
 public:
   Transitions()
@@ -61,6 +148,13 @@ public:
     col = NULL;
     row_ptr = NULL;
     data = NULL;
+
+    col_ptr = NULL;
+    row = NULL;
+    pos = NULL;
+
+    kind = GENERAL;
+    next = NULL;
   }
 
   Transitions(unsigned int Ns_, unsigned int Nnz_)
@@ -71,21 +165,33 @@ public:
     col = new unsigned int[Nnz_];
     row_ptr = new unsigned int[Ns_+1];
     data = new T[Nnz_];
+
+    col_ptr = NULL;
+    row = NULL;
+    pos = NULL;
+
+    kind = GENERAL;
+    next = NULL;
   }
 
+  /* the structure detected is dropped by the changes of
+     the single elements */
   void SetCol(unsigned int i, unsigned int j)
   {
     col[j] = i;
+    clear_kind();
   }
 
   void SetRowPtr(unsigned int p, unsigned int i)
   {
     row_ptr[i] = p;
+    clear_kind();
   }
 
   void SetData(T value, unsigned int i)
   {
     data[i] = value;
+    clear_kind();
   }
 
   /* retrieve matrix element (r,c) */
@@ -127,7 +233,38 @@ public:
   {
     for (std::size_t i = 0; i != imatrix.size(); ++i)
       for (std::size_t j = 0; j != imatrix[i].size(); ++j)
-	  omatrix[i][j] = Get(i,j) + omatrix[i][j]*eta;
+	  omatrix[i][j] = Get(i,j) + imatrix[i][j]*eta;
+  }
+
+  /* add to the elements stored the ones of the outer product
+     alpha*y*x^T, in place: the sparsity of the matrix is
+     preserved (the counts of the elements not stored, and of
+     the ones stored as zero, are dropped) in O(Nnz) */
+  void add_outer(T alpha, const T *y, const T *x)
+  {
+    for(unsigned int i = 0; i < Ns; i++)
+    {
+      T _alpha_y = alpha*y[i];
+
+      for(unsigned int k = row_ptr[i]; k < row_ptr[i+1]; k++)
+        if (data[k] != 0)
+          data[k] += _alpha_y*x[col[k]];
+    }
+
+    Detect();
+  }
+
+  /* sum of this matrix and the one given as a parameter (with the
+     same sparsity pattern) multiplied by a factor */
+  void sum(const Transitions<T>& b, T e)
+  {
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for(unsigned int k = 0; k < Nnz; k++)
+      data[k] += b.data[k]*e;
+
+    Detect();
   }
 
   void Eye()
@@ -140,11 +277,76 @@ public:
       col[i] = i;
       data[i] = 1;
     }
+
+    if (col_ptr)
+      CSC();
+
+    Detect();
+  }
+
+  /* build (or rebuild, after a change of the structure) the CSC
+     mirror of the matrix */
+  void CSC()
+  {
+    delete [] col_ptr;
+    delete [] row;
+    delete [] pos;
+
+    col_ptr = new unsigned int[Ns+1];
+    row = new unsigned int[Nnz];
+    pos = new unsigned int[Nnz];
+
+    std::fill(col_ptr, col_ptr + Ns + 1, 0);
+
+    for(unsigned int k = 0; k < Nnz; k++)
+      col_ptr[col[k]+1]++;
+
+    for(unsigned int c = 0; c < Ns; c++)
+      col_ptr[c+1] += col_ptr[c];
+
+    std::vector<unsigned int> next(col_ptr, col_ptr + Ns);
+
+    for(unsigned int i = 0; i < Ns; i++)
+      for(unsigned int k = row_ptr[i]; k < row_ptr[i+1]; k++)
+      {
+        unsigned int dest = next[col[k]]++;
+
+        row[dest] = i;
+        pos[dest] = k;
+      }
+  }
+
+  /* true if the CSC mirror is kept */
+  bool has_csc() const
+  {
+    return col_ptr != NULL;
+  }
+
+  /* number of elements stored in column c */
+  unsigned int get_col_nnz(unsigned int c) const
+  {
+    return col_ptr[c+1] - col_ptr[c];
+  }
+
+  /* row of the k-th element stored in column c */
+  unsigned int get_col_row(unsigned int c, unsigned int k) const
+  {
+    return row[col_ptr[c]+k];
+  }
+
+  /* value of the k-th element stored in column c */
+  T get_col_value(unsigned int c, unsigned int k) const
+  {
+    return data[pos[col_ptr[c]+k]];
   }
 
   /* normalisation (columns) */
   void Norm()
   {
+    /* the identity and the functional maps are normalised */
+    if (kind != GENERAL)
+      return;
+
     T sum[this->Ns];
     memset(sum, 0.0, this->Ns*sizeof(T));
 
@@ -159,6 +361,19 @@ public:
       else
         data[j] /= this->Ns;
     }
+
+    Detect();
+  }
+
+  Kind get_kind() const
+  {
+    return kind;
+  }
+
+  /* row of the element of column c of a functional map */
+  unsigned int get_next(unsigned int c) const
+  {
+    return next[c];
   }
 
   unsigned int get_size()
@@ -179,6 +394,13 @@ public:
     for(unsigned int j = 0; j < Ns; j++)
       y[j] = 0.0;
 
+    if (kind != GENERAL)
+    {
+      apply_map(x, y);
+
+      return y;
+    }
+
     for(unsigned int j = 0; j < Ns; j++)
     {
       T t = 0.0;
@@ -195,6 +417,13 @@ public:
   /* sparse matrix-vector multiplication */
   void Txv(T *x, T *y)
   {
+    if (kind == IDENTITY || (kind == FUNCTIONAL && x != y))
+    {
+      apply_map(x, y);
+
+      return;
+    }
+
     T* _y = new T[Ns];
 
     for(unsigned int j = 0; j < Ns; j++)
@@ -210,37 +439,143 @@ public:
     delete [] _y;
   }
 
+  /* sparse matrix-vector multiplication, the temporary vector
+     is taken from the arena a */
+  void Txv(T *x, T *y, Arena& a)
+  {
+    if (kind == IDENTITY || (kind == FUNCTIONAL && x != y))
+    {
+      apply_map(x, y);
+
+      return;
+    }
+
+    ArenaScope scope(a);
+
+    T* _y = a.Alloc<T>(Ns);
+
+    for(unsigned int j = 0; j < Ns; j++)
+      _y[j] = 0.0;
+
+    if (kind == FUNCTIONAL)
+    {
+      apply_map(x, _y);
+
+      for(unsigned int j = 0; j < Ns; j++)
+        y[j] = _y[j];
+
+      return;
+    }
+
+    for(unsigned int j = 0; j < Ns; j++)
+      for(unsigned int i = row_ptr[j]; i < row_ptr[j+1]; i++)
+        _y[j] = _y[j] + data[i]*x[col[i]];
+
+    for(unsigned int j = 0; j < Ns; j++)
+      y[j] = _y[j];
+  }
+
+  /* sparse matrix-dense matrix multiplication: x and y are
+     Ns by P dense blocks stored by rows, i.e. the element (j,p)
+     is in position j*P+p, so that each stored element of the
+     matrix is applied to P contiguous columns */
+  void Txm(T *x, T *y, unsigned int P)
+  {
+    if (kind == IDENTITY)
+    {
+      std::copy(x, x + (std::size_t) Ns*P, y);
+
+      return;
+    }
+
+    if (kind == FUNCTIONAL)
+    {
+      std::fill(y, y + (std::size_t) Ns*P, 0.0);
+
+      for(unsigned int c = 0; c < Ns; c++)
+      {
+        T *_y = &y[(std::size_t) next[c]*P];
+        const T *_x = &x[(std::size_t) c*P];
+
+        for(unsigned int p = 0; p < P; p++)
+          _y[p] += _x[p];
+      }
+
+      return;
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for(unsigned int j = 0; j < Ns; j++)
+    {
+      T *_y = &y[(std::size_t) j*P];
+
+      for(unsigned int p = 0; p < P; p++)
+        _y[p] = 0.0;
+
+      for(unsigned int i = row_ptr[j]; i < row_ptr[j+1]; i++)
+      {
+        const T *_x = &x[(std::size_t) col[i]*P];
+
+        opt_axpy<T>(P, data[i], _x, _y);
+      }
+    }
+  }
+
+  /* log(matrix)-vector multiplication, the elements not stored
+     being p0: the term log(p0)*sum(x) common to all the rows is
+     corrected on the stored elements only, in O(Nnz+Ns) */
   void logTxv(T *x, std::vector<T> &y)
   {
     T _log_po=_log(p0);
+    T _log_po_x = _log_po*sum(x);
 
 #ifdef _OPENMP
     #pragma omp parallel for
 #endif
     for(unsigned int i = 0; i < Ns; i++)
     {
-      T t=0.;
-      unsigned int itv = row_ptr[i];
-      unsigned int itv_ = row_ptr[i+1];
-      bool row_completed = false;
+      T t = _log_po_x;
 
-      for(unsigned int j = 0; j < Ns; j++)
-      {
-        if (itv == itv_)
-	  row_completed = true;
+      for(unsigned int j = row_ptr[i]; j < row_ptr[i+1]; j++)
+        t = t + (_log(data[j]+p0) - _log_po)*x[col[j]];
 
-        if (j == col[itv] && !row_completed)
-	{
-          //std::cout << "i=" << i << " j=" << j << " itv=" << itv << " data[" << itv << "]=" << data[itv] << " x[" << j << "]=" << x[j] << std::endl;
-          t = t + _log(data[itv]+p0)*x[j];
-	  itv++;
-	}
-	else
-	{
-          //std::cout << "i=" << i << " j=" << j << " itv=" << itv << " x[" << j << "]=" << x[j] << std::endl;
-          t = t + _log_po*x[j];	
-	}
-      }
+      y[i] = y[i] + t;
+    }
+  }
+
+  /* return a new object with the logarithms of the stored
+     elements relative to the one of the elements not stored,
+     log(data+p0)-log(p0): the log-domain copy read by lnTxv */
+  Transitions *Log()
+  {
+    Transitions<T> *l = new Transitions<T>(*this);
+    T _log_po=_log(p0);
+
+    for(unsigned int i = 0; i < Nnz; i++)
+      l->data[i] = _log(data[i]+p0) - _log_po;
+
+    l->clear_kind();
+
+    return l;
+  }
+
+  /* as logTxv, on the log-domain copy made by Log(), without
+     evaluating any logarithm */
+  void lnTxv(T *x, std::vector<T> &y)
+  {
+    T _log_po_x = _log(p0)*sum(x);
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for(unsigned int i = 0; i < Ns; i++)
+    {
+      T t = _log_po_x;
+
+      for(unsigned int j = row_ptr[i]; j < row_ptr[i+1]; j++)
+        t = t + data[j]*x[col[j]];
 
       y[i] = y[i] + t;
     }
@@ -249,6 +584,21 @@ public:
   /* store the f-th column in vector s */
   void extract_column(unsigned int f, std::vector<T> &s)
   {
+    if (kind != GENERAL)
+    {
+      s.at(next[f]) = 1;
+
+      return;
+    }
+
+    if (col_ptr)
+    {
+      for(unsigned int k = col_ptr[f]; k < col_ptr[f+1]; k++)
+        s.at(row[k]) = data[pos[k]];
+
+      return;
+    }
+
     for(unsigned int i = 0; i < Ns; i++)
       for(unsigned int j = row_ptr[i]; j < row_ptr[i+1]; j++)
         if (col[j] == f)
@@ -264,6 +614,21 @@ public:
     T max = 0;
     int maxindex = -1;
 
+    if (kind != GENERAL)
+      return next[f];
+
+    if (col_ptr)
+    {
+      for(unsigned int k = col_ptr[f]; k < col_ptr[f+1]; k++)
+        if (data[pos[k]] > max)
+        {
+          max = data[pos[k]];
+          maxindex = row[k];
+        }
+
+      return maxindex;
+    }
+
     for(unsigned int i = 0; i < Ns; i++)
       for(unsigned int j = row_ptr[i]; j < row_ptr[i+1]; j++)
         if (col[j] == f)
@@ -278,6 +643,40 @@ public:
     return maxindex;
   }
 
+  /* sample a row from the distribution of the f-th column
+     using the uniform random number rand1, as CDFs on the
+     column extracted, without extracting it */
+  int Sample(unsigned int f, const T rand1)
+  {
+    if (kind != GENERAL)
+      return next[f];
+
+    if (!col_ptr)
+    {
+      std::vector<T> p(Ns, 0.0);
+      extract_column(f, p);
+
+      return CDFs<T>(p, rand1);
+    }
+
+    T cdf = 0.0;
+
+    for(unsigned int k = col_ptr[f]; k < col_ptr[f+1]; k++)
+    {
+      cdf += data[pos[k]];
+
+      if (rand1 < cdf)
+        return row[k];
+    }
+
+    std::cerr << "Sample: no sample found: rand=" << rand1 << " cdf=" << cdf << std::endl;
+
+    if ( (ABS(1-cdf) < maxError) && (rand1 <= 1) && col_ptr[f+1] > col_ptr[f] )
+      return row[col_ptr[f+1]-1];
+    else
+      exit(-2);
+  }
+
   /* constructor by passing a matrix */
   Transitions(std::vector<std::vector<T>> const &matrix)
   {
@@ -290,6 +689,13 @@ public:
     row_ptr = new unsigned int[this->Ns+1];
     data = new T[this->Nnz];
 
+    col_ptr = NULL;
+    row = NULL;
+    pos = NULL;
+
+    kind = GENERAL;
+    next = NULL;
+
     std::size_t k = 0;
     for (std::size_t i = 0; i < matrix.size(); ++i)
     {
@@ -313,6 +719,8 @@ public:
     }
 
     row_ptr[this->Ns] = k;
+
+    Detect();
     //std::cout << "row_ptr[" << this->Ns << "]=" << row_ptr[this->Ns] << std::endl;
   }
 
@@ -336,12 +744,28 @@ public:
       row_ptr[i] = t.row_ptr[i];
 
     row_ptr[this->Ns] = t.row_ptr[this->Ns];
+
+    col_ptr = NULL;
+    row = NULL;
+    pos = NULL;
+
+    kind = GENERAL;
+    next = NULL;
+
+    if (t.col_ptr)
+      CSC();
+
+    Detect();
   }
 
   ~Transitions() {
     delete [] col;
     delete [] row_ptr;
     delete [] data;
+    delete [] col_ptr;
+    delete [] row;
+    delete [] pos;
+    delete [] next;
   }
 
   void Print()
@@ -384,6 +808,11 @@ public:
       this->row_ptr[j] = last;
       last = temp;
     }
+
+    if (this->col_ptr)
+      CSC();
+
+    Detect();
   }
 };
 #endif
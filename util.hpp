@@ -37,25 +37,88 @@
 #include <stdlib.h>
 #include <algorithm>
 #include "constants.h"
+#include "simd.hpp"
 #define ABS(x) ( (x) > 0.0 ? x : -(x) )
 
-/* softmax activation function */
+/* type of the sums (dot products, free energies, softmax
+   normalisation) of arrays of type T: the single precision
+   models keep their arrays in float, to halve the memory
+   traffic, and accumulate in double */
 template <typename T>
-void softmax(std::vector<T>& expectation)
+struct accumulator {
+  typedef T type;
+};
+
+template <>
+struct accumulator<float> {
+  typedef double type;
+};
+
+/* maximum of the N elements of x */
+template <typename T>
+T opt_max(std::size_t N, const T *x)
 {
   T m = -INFINITY;
-  for (std::size_t i = 0; i < expectation.size(); i++) {
-    if (expectation[i] > m) {
-      m = expectation[i];
+  for (std::size_t i = 0; i < N; i++) {
+    if (x[i] > m) {
+      m = x[i];
     }
   }
 
-  T sum = 0.0;
+  return m;
+}
+
+/* y = alpha x */
+template <typename T>
+void opt_scale(std::size_t N, T alpha, const T *x, T *y)
+{
+  for (std::size_t i = 0; i < N; i++)
+    y[i] = alpha * x[i];
+}
+
+/* y = y + alpha x */
+template <typename T>
+void opt_axpy(std::size_t N, T alpha, const T *x, T *y)
+{
+  for (std::size_t i = 0; i < N; i++)
+    y[i] = y[i] + alpha * x[i];
+}
+
+/* double precision: SIMD kernels selected at run time (simd.hpp) */
+template <>
+inline double opt_max<double>(std::size_t N, const double *x)
+{
+  return simd::get().max(N, x);
+}
+
+template <>
+inline void opt_scale<double>(std::size_t N, double alpha, const double *x,
+                              double *y)
+{
+  simd::get().scale(N, alpha, x, y);
+}
+
+template <>
+inline void opt_axpy<double>(std::size_t N, double alpha, const double *x,
+                             double *y)
+{
+  simd::get().axpy(N, alpha, x, y);
+}
+
+/* softmax activation function, computed with the
+   accumulator type of T */
+template <typename T>
+void softmax(std::vector<T>& expectation)
+{
+  typedef typename accumulator<T>::type A;
+  A m = opt_max<T>(expectation.size(), expectation.data());
+
+  A sum = 0.0;
   for (std::size_t i = 0; i < expectation.size(); i++) {
     sum += exp(expectation[i] - m);
   }
 
-  const T scale = m + log(sum);
+  const A scale = m + log(sum);
   for (std::size_t i = 0;  i < expectation.size();  i++) {
     expectation[i] = exp(expectation[i] - scale);
   }
@@ -64,19 +127,15 @@ void softmax(std::vector<T>& expectation)
 template <typename T>
 void softmax(T *expectation, std::size_t size)
 {
-  T m = -INFINITY;
-  for (std::size_t i = 0; i < size; i++) {
-    if (expectation[i] > m) {
-      m = expectation[i];
-    }
-  }
+  typedef typename accumulator<T>::type A;
+  A m = opt_max<T>(size, expectation);
 
-  T sum = 0.0;
+  A sum = 0.0;
   for (std::size_t i = 0; i < size; i++) {
     sum += exp(expectation[i] - m);
   }
 
-  const T scale = m + log(sum);
+  const A scale = m + log(sum);
   for (std::size_t i = 0;  i < size;  i++) {
     expectation[i] = exp(expectation[i] - scale);
   }
@@ -162,8 +221,9 @@ std::vector<int> findMaxima(std::vector<T> &p)
 template <typename T>
 T opt_dot(unsigned int N, T *X, T *x)
 {
+  typedef typename accumulator<T>::type A;
   T dot = 0.0;
-  T temp = 0.0;
+  A temp = 0.0;
 
   if (N == 0)
     return dot;
@@ -193,20 +253,21 @@ T opt_dot(unsigned int N, T *X, T *x)
   return dot;
 }
 
+/* logarithm with log(0) = log0; as log0 = log(p0) the
+   argument is selected instead of the result, so that
+   the loops calling it have no branch */
 template <typename T>
 T _log(T a)
 {
-  if (a > 0)
-    return log(a);
-  else
-    return log0;
+  return log(a > 0 ? a : (T) p0);
 }
 
 template <typename T>
 T opt_hdot(unsigned int N, T *X, T *x)
 {
+  typedef typename accumulator<T>::type A;
   T h = 0.0;
-  T _temp = 0.0;
+  A _temp = 0.0;
 
   if (N == 0)
     return h;
@@ -242,9 +303,10 @@ T opt_hdot(unsigned int N, T *X, T *x)
 template <typename T>
 T opt_dot(unsigned int N, T *X, T *x, T *h)
 {
+  typedef typename accumulator<T>::type A;
   T dot = 0.0;
-  T temp = 0.0;
-  T _temp = 0.0;
+  A temp = 0.0;
+  A _temp = 0.0;
 
   if (N == 0)
     return dot;
@@ -287,9 +349,10 @@ T opt_dot(unsigned int N, T *X, T *x, T *h)
 template <typename T>
 T opt_dot(unsigned int N, T *X, T *_X, T *x, T *h)
 {
+  typedef typename accumulator<T>::type A;
   T dot = 0.0;
-  T temp = 0.0;
-  T _temp = 0.0;
+  A temp = 0.0;
+  A _temp = 0.0;
 
   if (N == 0)
     return dot;
@@ -327,4 +390,33 @@ T opt_dot(unsigned int N, T *X, T *_X, T *x, T *h)
 
   return dot;
 }
+template <>
+inline double opt_dot<double>(unsigned int N, double *X, double *x)
+{
+  return simd::get().dot(N, X, x);
+}
+
+template <>
+inline double opt_dot<double>(unsigned int N, double *X, double *_X,
+                              double *x, double *h)
+{
+  return simd::get().dot2(N, X, _X, x, h);
+}
+
+template <>
+inline float opt_dot<float>(unsigned int N, float *X, float *x)
+{
+  return simd::get().dotf(N, X, x);
+}
+
+template <>
+inline float opt_dot<float>(unsigned int N, float *X, float *_X,
+                            float *x, float *h)
+{
+  double _h;
+  float dot = simd::get().dot2f(N, X, _X, x, &_h);
+  *h = _h;
+
+  return dot;
+}
 #endif